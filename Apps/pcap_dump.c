@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// For open, ...
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+// For read, close, ...
+#include <unistd.h>
+
+#include "../P04_vnic/pkt_capture.h" // CaptureRec
+
+/*
+ * Converts the header capture records of the driver (from its per CPU relay files) into a pcap file, in time order.
+ * Takes the records available in the files, through read(), which frees up their sub-buffers. Not a streaming
+ * reader, & so to be run after stopping the capture, which flushes them all, & w/ buffers enough for the capture
+ * (else, see capture_dropped):
+ * echo 1 > /sys/kernel/debug/pnd/ethX/capture; ...; echo 0 > /sys/kernel/debug/pnd/ethX/capture
+ * ./pcap_dump ethX.pcap /sys/kernel/debug/pnd/ethX/capture[0-9]*
+ */
+
+#define PCAP_MAGIC_NSEC 0xA1B23C4D // Timestamps in ns
+#define PCAP_LINKTYPE_ETHERNET 1
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version_major, version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} PcapHdr;
+typedef struct
+{
+	uint32_t ts_sec, ts_nsec;
+	uint32_t incl_len, orig_len;
+} PcapRecHdr;
+
+static int cmp_tstamp(const void *a, const void *b)
+{
+	const CaptureRec *x = a, *y = b;
+
+	return (x->tstamp > y->tstamp) - (x->tstamp < y->tstamp);
+}
+
+static CaptureRec *read_recs(const char *fn, CaptureRec *recs, int *n, int *max) // Appended to recs
+{
+	CaptureRec *r;
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(fn, O_RDONLY)) == -1)
+	{
+		perror(fn);
+		return recs;
+	}
+	for (;;)
+	{
+		if (*n == *max)
+		{
+			*max = *max ? *max * 2 : 4096;
+			if (!(r = realloc(recs, *max * sizeof(CaptureRec))))
+			{
+				perror("realloc");
+				break;
+			}
+			recs = r;
+		}
+		// Sub-buffers are exactly filled w/ the records. So, they are read out whole
+		if ((len = read(fd, &recs[*n], sizeof(CaptureRec))) != sizeof(CaptureRec))
+		{
+			if (len == -1)
+			{
+				perror(fn);
+			}
+			break; // Nothing more, as of now
+		}
+		(*n)++;
+	}
+	close(fd);
+	return recs;
+}
+
+int main(int argc, char *argv[])
+{
+	PcapHdr hdr = { PCAP_MAGIC_NSEC, 2, 4, 0, 0, CAPTURE_SNAPLEN, PCAP_LINKTYPE_ETHERNET };
+	PcapRecHdr rhdr;
+	CaptureRec *recs = NULL;
+	int i, n = 0, max = 0, rx = 0, tx = 0;
+	FILE *fp;
+
+	if (argc < 3)
+	{
+		printf("Usage : %s <pcap file> <capture file(s)>\n", argv[0]);
+		printf("\tTo be run after stopping the capture, as reads only the records flushed by then\n");
+		return 1;
+	}
+	for (i = 2; i < argc; i++)
+	{
+		recs = read_recs(argv[i], recs, &n, &max);
+	}
+	qsort(recs, n, sizeof(CaptureRec), cmp_tstamp); // Across the CPUs
+	if (!(fp = fopen(argv[1], "wb")))
+	{
+		perror(argv[1]);
+		free(recs);
+		return 2;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	for (i = 0; i < n; i++)
+	{
+		rhdr.ts_sec = recs[i].tstamp / 1000000000;
+		rhdr.ts_nsec = recs[i].tstamp % 1000000000;
+		rhdr.incl_len = recs[i].caplen;
+		rhdr.orig_len = recs[i].len;
+		fwrite(&rhdr, sizeof(rhdr), 1, fp);
+		fwrite(recs[i].data, recs[i].caplen, 1, fp);
+		if (recs[i].dir == CAPTURE_DIR_TX)
+		{
+			tx++;
+		}
+		else
+		{
+			rx++;
+		}
+	}
+	if (fclose(fp) == EOF)
+	{
+		perror(argv[1]);
+		free(recs);
+		return 2;
+	}
+	printf("%d pkt(s) (rx: %d, tx: %d) written into %s\n", n, rx, tx, argv[1]);
+	free(recs);
+	return 0;
+}
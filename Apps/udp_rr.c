@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// For socket, ...
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h> // struct timeval
+// For close, ...
+#include <unistd.h>
+#include <arpa/inet.h> // struct sockaddr_in, hton...
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#define MAX_PAYLOAD 1472 // For an MTU of 1500
+
+/*
+ * UDP request / response latency: The client sends a request & waits for its echo from the server,
+ * one at a time, & reports the round trip time percentiles. With a non-zero busy poll (in usecs),
+ * the socket busy polls the napi of its last rx pkt while waiting, instead of sleeping for the interrupt
+ */
+
+static int set_busy_poll(int sfd, int usecs)
+{
+	if (!usecs)
+	{
+		return 0;
+	}
+	if (setsockopt(sfd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) == -1)
+	{
+		perror("setsockopt SO_BUSY_POLL");
+		return -1;
+	}
+	return 0;
+}
+static int cmp_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)(a), y = *(const long long *)(b);
+
+	return (x > y) - (x < y);
+}
+static long long pct(const long long *rtts, int n, int per_mille)
+{
+	return rtts[((long long)(n) * per_mille) / 1000];
+}
+
+static int server(int port, int busy_poll)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len;
+	char buf[MAX_PAYLOAD];
+	int sfd, len;
+
+	if ((sfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+	{
+		perror("socket");
+		return 2;
+	}
+	if (set_busy_poll(sfd, busy_poll) == -1)
+	{
+		close(sfd);
+		return 2;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(sfd, (struct sockaddr *)(&addr), sizeof(addr)) == -1)
+	{
+		perror("bind");
+		close(sfd);
+		return 2;
+	}
+	for (;;) // Echo back every request
+	{
+		addr_len = sizeof(addr);
+		if ((len = recvfrom(sfd, buf, sizeof(buf), 0, (struct sockaddr *)(&addr), &addr_len)) == -1)
+		{
+			perror("recvfrom");
+			break;
+		}
+		if (sendto(sfd, buf, len, 0, (struct sockaddr *)(&addr), addr_len) == -1)
+		{
+			perror("sendto");
+			break;
+		}
+	}
+	close(sfd);
+	return 2;
+}
+static int client(const char *ip, int port, int count, int busy_poll, int size)
+{
+	struct sockaddr_in addr;
+	struct timeval tv = { .tv_sec = 1 }; // Request / Response considered lost after this
+	struct timespec start, end;
+	char buf[MAX_PAYLOAD];
+	long long *rtts;
+	int sfd, i, n, lost;
+
+	if ((sfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+	{
+		perror("socket");
+		return 2;
+	}
+	if ((set_busy_poll(sfd, busy_poll) == -1) ||
+		(setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1))
+	{
+		perror("setsockopt");
+		close(sfd);
+		return 2;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1)
+	{
+		printf("Invalid IP address %s\n", ip);
+		close(sfd);
+		return 1;
+	}
+	// Connected, so as to receive only from the server
+	if (connect(sfd, (struct sockaddr *)(&addr), sizeof(addr)) == -1)
+	{
+		perror("connect");
+		close(sfd);
+		return 2;
+	}
+	if (!(rtts = malloc(count * sizeof(*rtts))))
+	{
+		perror("malloc");
+		close(sfd);
+		return 2;
+	}
+	memset(buf, 0xA5, size);
+	for (i = n = lost = 0; i < count; i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (send(sfd, buf, size, 0) == -1)
+		{
+			perror("send");
+			break;
+		}
+		if (recv(sfd, buf, sizeof(buf), 0) == -1)
+		{
+			lost++;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		rtts[n++] = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	}
+	close(sfd);
+	if (!n)
+	{
+		printf("No responses (%d lost)\n", lost);
+		free(rtts);
+		return 2;
+	}
+	qsort(rtts, n, sizeof(*rtts), cmp_ns);
+	printf("busy_poll %d us, %d byte(s): %d rtt(s), %d lost (in us): min %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+		busy_poll, size, n, lost, rtts[0] / 1000.0, pct(rtts, n, 500) / 1000.0,
+		pct(rtts, n, 990) / 1000.0, pct(rtts, n, 999) / 1000.0, rtts[n - 1] / 1000.0);
+	free(rtts);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int size;
+
+	if ((argc >= 3) && (argc <= 4) && !strcmp(argv[1], "server"))
+	{
+		return server(atoi(argv[2]), (argc == 4) ? atoi(argv[3]) : 0);
+	}
+	else if ((argc >= 5) && (argc <= 7) && !strcmp(argv[1], "client"))
+	{
+		size = (argc == 7) ? atoi(argv[6]) : 64;
+		if ((size <= 0) || (size > MAX_PAYLOAD))
+		{
+			printf("Payload size should be from 1 to %d\n", MAX_PAYLOAD);
+			return 1;
+		}
+		return client(argv[2], atoi(argv[3]), atoi(argv[4]), (argc >= 6) ? atoi(argv[5]) : 0, size);
+	}
+	printf("Usage : %s server <port> [ <busy poll usecs> ]\n", argv[0]);
+	printf("Usage : %s client <server ip> <port> <count> [ <busy poll usecs> [ <payload size> ] ]\n", argv[0]);
+	return 1;
+}
@@ -10,9 +10,12 @@
 #include <linux/tcp.h> // struct tcphdr, TCP definitions
 #include <linux/byteorder/generic.h> // ntoh...
 #include <linux/spinlock.h> // spinlock_t, ...
+#include <linux/percpu.h> // per_cpu_ptr, free_percpu, ...
+#include <linux/u64_stats_sync.h> // u64_stats_update_begin, ...
 
 #define DRV_PREFIX "lnd"
 #include "common.h"
+#include "pkt_trace.h"
 
 #define LND_NAPI_WEIGHT 64
 
@@ -112,6 +115,21 @@ static void display_packet(struct sk_buff *skb)
 	}
 }
 
+static void lnd_clear_tstats(struct net_device *dev) // Per CPU pkt & byte counters
+{
+	struct pcpu_sw_netstats *tstats;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		tstats = per_cpu_ptr(dev->tstats, cpu);
+		u64_stats_update_begin(&tstats->syncp);
+		tstats->rx_packets = tstats->rx_bytes = 0;
+		tstats->tx_packets = tstats->tx_bytes = 0;
+		u64_stats_update_end(&tstats->syncp);
+	}
+}
+
 static int lnd_open(struct net_device *dev)
 {
 	DrvPvt *pvt = netdev_priv(dev);
@@ -133,6 +151,7 @@ static int lnd_close(struct net_device *dev)
 	spin_unlock_irqrestore(&pvt->lock, flags);
 	// Clear the stats
 	memset(&dev->stats, 0, sizeof(dev->stats));
+	lnd_clear_tstats(dev);
 	return 0;
 }
 static int lnd_start_xmit(struct sk_buff *skb, struct net_device *dev)
@@ -140,8 +159,8 @@ static int lnd_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	DrvPvt *pvt = netdev_priv(dev);
 	unsigned long flags;
 
-	iprintk("tx\n");
-	display_packet(skb);
+	tprintk("tx\n");
+	pkt_trace_display(skb);
 
 	spin_lock_irqsave(&pvt->lock, flags);
 	if (pvt->skb) // Loopback Hack: Previous pkt not yet transmitted. Drop it :)
@@ -172,6 +191,7 @@ static const struct net_device_ops lnd_netdev_ops =
 	.ndo_stop = lnd_close,
 	.ndo_start_xmit = lnd_start_xmit,
 	.ndo_set_mac_address = lnd_set_mac_address,
+	.ndo_get_stats64 = dev_get_tstats64, // Per CPU counters in dev->tstats, alongwith the rest in dev->stats
 };
 
 static int lnd_poll(struct napi_struct *napi_ptr, int budget)
@@ -183,7 +203,7 @@ static int lnd_poll(struct napi_struct *napi_ptr, int budget)
 	int pkt_size;
 	unsigned int work_done;
 
-	iprintk("poll\n");
+	tprintk("poll\n");
 	spin_lock_irqsave(&pvt->lock, flags);
 	skb = pvt->skb;
 	pvt->skb = NULL;
@@ -197,14 +217,12 @@ static int lnd_poll(struct napi_struct *napi_ptr, int budget)
 	else
 	{
 		// Loopback Hack: Update for pkt transmission complete
-		dev->stats.tx_packets++;
-		dev->stats.tx_bytes += skb->len;
+		dev_sw_netstats_tx_add(dev, 1, skb->len);
 
 		// Loopback Hack: Get size of the received pkt
 		pkt_size = skb->len;
 
-		dev->stats.rx_packets++;
-		dev->stats.rx_bytes += pkt_size;
+		dev_sw_netstats_rx_add(dev, pkt_size);
 		//skb_put(skb, pkt_size); // Loopback Hack: Not to be done here as it is already set
 		//skb->protocol = eth_type_trans(skb, dev); // Loopback Hack: Not needed here as it is already set
 		//napi_gro_receive(&pvt->napi, skb); // TODO: Handover to the network stack
@@ -233,6 +251,14 @@ static int lnd_init(void)
 		eprintk("device allocation failed\n");
 		return -ENOMEM;
 	}
+	// Per CPU counters for the pkts & bytes, so as not to contend across the cores
+	dev->tstats = netdev_alloc_pcpu_stats(struct pcpu_sw_netstats);
+	if (!dev->tstats)
+	{
+		eprintk("stats allocation failed\n");
+		free_netdev(dev);
+		return -ENOMEM;
+	}
 	pvt = netdev_priv(dev);
 	pvt->ndev = dev;
 	spin_lock_init(&pvt->lock);
@@ -247,6 +273,7 @@ static int lnd_init(void)
 	if ((ret = register_netdev(dev)))
 	{
 		eprintk("%s network interface registration failed w/ error %i\n", dev->name, ret);
+		free_percpu(dev->tstats);
 		free_netdev(dev);
 	}
 	else
@@ -263,6 +290,7 @@ static void lnd_exit(void)
 	iprintk("exit\n");
 	unregister_netdev(dev);
 	netif_napi_del(&pvt->napi);
+	free_percpu(dev->tstats);
 	free_netdev(dev);
 }
 
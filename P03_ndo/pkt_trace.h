@@ -0,0 +1,78 @@
+#ifndef PKT_TRACE_H
+#define PKT_TRACE_H
+
+#ifdef __KERNEL__
+
+#include <linux/moduleparam.h> // module_param_cb, ...
+#include <linux/jump_label.h> // DEFINE_STATIC_KEY_FALSE, static_branch_unlikely, ...
+#include <linux/ratelimit.h> // DEFINE_RATELIMIT_STATE, __ratelimit, printk_ratelimited
+#include <linux/atomic.h> // atomic_t, ...
+
+/*
+ * Pkt tracing of the fast paths, through display_packet() of the including driver & tprintk().
+ * Off by default, as display_packet() prints around ten lines per pkt. Then, it is just a patched out branch.
+ * On, every pkt_trace'th pkt is displayed (1 => every pkt), w/ at most PKT_TRACE_BURST per PKT_TRACE_INTERVAL.
+ * Toggled through the pkt_trace module parameter, while loading or thereafter through
+ * /sys/module/<module>/parameters/pkt_trace
+ */
+#define PKT_TRACE_INTERVAL (5 * HZ)
+#define PKT_TRACE_BURST 10
+
+static DEFINE_STATIC_KEY_FALSE(pkt_trace_key);
+static unsigned int pkt_trace; // 0 => Off. Else, 1 in pkt_trace pkts is displayed
+static atomic_t pkt_trace_cnt = ATOMIC_INIT(0);
+static DEFINE_RATELIMIT_STATE(pkt_trace_rs, PKT_TRACE_INTERVAL, PKT_TRACE_BURST);
+
+static inline void pkt_trace_set(unsigned int n) // Also, for the other controls, like an ethtool private flag
+{
+	if (n)
+	{
+		WRITE_ONCE(pkt_trace, n);
+		static_branch_enable(&pkt_trace_key);
+	}
+	else
+	{
+		static_branch_disable(&pkt_trace_key);
+		WRITE_ONCE(pkt_trace, 0);
+	}
+}
+static int pkt_trace_param_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int n;
+	int ret;
+
+	if ((ret = kstrtouint(val, 0, &n)))
+	{
+		return ret;
+	}
+	pkt_trace_set(n);
+	return 0;
+}
+static const struct kernel_param_ops pkt_trace_param_ops =
+{
+	.set = pkt_trace_param_set,
+	.get = param_get_uint,
+};
+module_param_cb(pkt_trace, &pkt_trace_param_ops, &pkt_trace, 0644);
+MODULE_PARM_DESC(pkt_trace, "Display 1 in pkt_trace pkts, rate limited (default: 0 => off)");
+
+static inline bool pkt_trace_sample(void) // To be called only w/ the tracing on
+{
+	unsigned int n = READ_ONCE(pkt_trace);
+
+	if ((!n) || (atomic_inc_return(&pkt_trace_cnt) % n)) // Turned off in between, or not this one
+	{
+		return false;
+	}
+	return __ratelimit(&pkt_trace_rs);
+}
+
+#define pkt_trace_display(skb) \
+	do { if (static_branch_unlikely(&pkt_trace_key) && pkt_trace_sample()) display_packet(skb); } while (0)
+/* Per call (pkt or poll) info print, only w/ the tracing on, & rate limited */
+#define tprintk(fmt, args...) \
+	do { if (static_branch_unlikely(&pkt_trace_key)) printk_ratelimited(KERN_INFO DRV_PREFIX ": " fmt, ## args); } while (0)
+
+#endif
+
+#endif
@@ -12,6 +12,7 @@
 
 #define DRV_PREFIX "tnd"
 #include "common.h"
+#include "pkt_trace.h"
 
 typedef struct _DrvPvt
 {
@@ -120,8 +121,8 @@ static int tnd_close(struct net_device *dev)
 }
 static int tnd_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
-	iprintk("tx\n");
-	display_packet(skb);
+	tprintk("tx\n");
+	pkt_trace_display(skb);
 	// TODO 4: Uncomment the following to see the statistics effect
 	//dev->stats.tx_dropped++;
 	dev_kfree_skb(skb); // As we are not using it any further
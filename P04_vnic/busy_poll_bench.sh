@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# UDP request / response latency, w/ busy polling off & on, over the VNIC pair set up by ./setup_all.sh
+# The NIC side is moved into a netns as the peer, running the echo server of Apps/udp_rr.
+# The driver side busy polls w/ SO_BUSY_POLL, alone, & alongwith napi_defer_hard_irqs & gro_flush_timeout,
+# keeping its interrupt masked between the busy polls.
+# The results (rtt min, p50, p99, p99.9 & max) are appended w/ the test set up into ${RESULTS}, as the record
+# of the measurements. None are committed, as they are specific to the host running them.
+# Usage: ./busy_poll_bench.sh [ <driver interface> [ <count> [ <busy poll usecs> ] ] ]
+
+DRV_IF=${1:-ethX}
+NIC_IF=nic
+COUNT=${2:-100000}
+BUSY_POLL=${3:-50}
+NS=vnic_peer
+NIC_IP=192.168.64.2
+PORT=45000
+UDP_RR=../Apps/udp_rr
+RESULTS=busy_poll_results.txt
+
+if [ ! -x ${UDP_RR} ]
+then
+	echo "${UDP_RR} not present. Run make in ../Apps first"
+	exit 1
+fi
+if [ ! -e /sys/class/net/${DRV_IF} ] || [ ! -e /sys/class/net/${NIC_IF} ]
+then
+	echo "${DRV_IF} / ${NIC_IF} not present. Run ./setup_all.sh first"
+	exit 1
+fi
+
+defer() # <napi_defer_hard_irqs> <gro_flush_timeout in ns>
+{
+	echo $1 > /sys/class/net/${DRV_IF}/napi_defer_hard_irqs
+	echo $2 > /sys/class/net/${DRV_IF}/gro_flush_timeout
+}
+
+# NIC side as the peer
+ip netns add ${NS}
+ip link set ${NIC_IF} netns ${NS}
+ip netns exec ${NS} ip addr add ${NIC_IP}/24 dev ${NIC_IF}
+ip netns exec ${NS} ip link set ${NIC_IF} up
+ip netns exec ${NS} ${UDP_RR} server ${PORT} ${BUSY_POLL} &
+sleep 1
+${UDP_RR} client ${NIC_IP} ${PORT} 1000 > /dev/null # Warm up, incl. the arp resolution
+
+{
+	echo "# $(date -u '+%F %T') UTC, kernel $(uname -r), $(nproc) CPU(s) ($(grep -m 1 'model name' /proc/cpuinfo | cut -d: -f2 | sed 's/^ //'))"
+	echo "# ${DRV_IF}: $(ls -d /sys/class/net/${DRV_IF}/queues/rx-* | wc -l) queue(s), threaded napi $(cat /sys/class/net/${DRV_IF}/threaded), ${COUNT} rtt(s) per run"
+	echo -n "Interrupt driven: "
+	${UDP_RR} client ${NIC_IP} ${PORT} ${COUNT}
+	echo -n "Busy polling: "
+	${UDP_RR} client ${NIC_IP} ${PORT} ${COUNT} ${BUSY_POLL}
+	defer 2 200000
+	echo -n "Busy polling w/ deferred interrupts: "
+	${UDP_RR} client ${NIC_IP} ${PORT} ${COUNT} ${BUSY_POLL}
+	defer 0 0
+} | tee -a ${RESULTS}
+
+kill %1
+wait 2> /dev/null
+
+# Back as set up by ./nic.sh, as the NIC interface returns to the init netns on deleting the netns
+ip netns del ${NS}
+sleep 1
+echo 1 > /proc/sys/net/ipv6/conf/${NIC_IF}/disable_ipv6
+ip addr add 192.168.65.1/24 broadcast 192.168.65.255 dev ${NIC_IF}
+ip link set ${NIC_IF} up
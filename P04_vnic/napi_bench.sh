@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# Softirq vs threaded NAPI, under CPU contention, over the VNIC pair set up by ./setup_all.sh
+# The NIC side is moved into a netns as the peer, so that the pkts actually go through the VNIC.
+# Needs iperf3 & ping. Usage: ./napi_bench.sh [ <driver interface> [ <duration in secs> ] ]
+
+DRV_IF=${1:-ethX}
+NIC_IF=nic
+DURATION=${2:-10}
+NS=vnic_peer
+DRV_IP=192.168.64.1
+NIC_IP=192.168.64.2
+HOGS=$(nproc) # One busy loop per core, competing w/ the polling
+
+set_threaded()
+{
+	echo $1 > /sys/class/net/${DRV_IF}/threaded
+	ip netns exec ${NS} sh -c "echo $1 > /sys/class/net/${NIC_IF}/threaded"
+}
+
+hogs_start()
+{
+	for i in $(seq 0 $((HOGS - 1)))
+	do
+		taskset -c ${i} sh -c 'while :; do :; done' &
+	done
+}
+
+hogs_stop()
+{
+	kill $(jobs -p) 2> /dev/null
+	wait 2> /dev/null
+}
+
+latency() # p50 / p99 / p99.9 of the rtts (in ms)
+{
+	ping -q -c 1 -W 1 ${NIC_IP} > /dev/null # Resolve the arp
+	ping -i 0.001 -w ${DURATION} ${NIC_IP} 2> /dev/null | sed -n 's/.*time=\([0-9.]*\).*/\1/p' | sort -n |
+		awk '{ v[NR] = $1 } END { if (NR) printf "p50 %s, p99 %s, p99.9 %s (%d samples)\n", v[int(NR * 0.5) + 1], v[int(NR * 0.99) + 1], v[int(NR * 0.999) + 1], NR; else print "no replies" }'
+}
+
+throughput() # Over the driver -> NIC direction
+{
+	ip netns exec ${NS} iperf3 -s -1 -D > /dev/null
+	sleep 1
+	iperf3 -c ${NIC_IP} -t ${DURATION} -f m | awk '/receiver/ { print $7, $8 }'
+}
+
+if [ ! -e /sys/class/net/${DRV_IF} ] || [ ! -e /sys/class/net/${NIC_IF} ]
+then
+	echo "${DRV_IF} / ${NIC_IF} not present. Run ./setup_all.sh first"
+	exit 1
+fi
+
+# NIC side as the peer
+ip netns add ${NS}
+ip link set ${NIC_IF} netns ${NS}
+ip netns exec ${NS} ip addr add ${NIC_IP}/24 dev ${NIC_IF}
+ip netns exec ${NS} ip link set ${NIC_IF} up
+ip netns exec ${NS} ip link set lo up
+
+for mode in 0 1
+do
+	set_threaded ${mode}
+	[ ${mode} -eq 0 ] && name=softirq || name=threaded
+	echo "${name}: idle: throughput $(throughput), latency $(latency)"
+	hogs_start
+	echo "${name}: ${HOGS} hog(s): throughput $(throughput), latency $(latency)"
+	hogs_stop
+done
+set_threaded 0
+
+# Back as set up by ./nic.sh, as the NIC interface returns to the init netns on deleting the netns
+ip netns del ${NS}
+sleep 1
+echo 1 > /proc/sys/net/ipv6/conf/${NIC_IF}/disable_ipv6
+ip addr add 192.168.65.1/24 broadcast 192.168.65.255 dev ${NIC_IF}
+ip link set ${NIC_IF} up
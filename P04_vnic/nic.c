@@ -9,61 +9,311 @@
 #include <linux/udp.h> // struct udphdr, UDP definitions
 #include <linux/tcp.h> // struct tcphdr, TCP definitions
 #include <linux/byteorder/generic.h> // ntoh...
+#include <linux/cpumask.h> // for_each_online_cpu, ...
+#include <linux/u64_stats_sync.h> // struct u64_stats_sync, ...
 /* Following are the NIC Simulation related headers */
-#include <linux/spinlock.h> // spinlock_t, ...
+#include <linux/cache.h> // ____cacheline_aligned_in_smp
+#include <linux/log2.h> // is_power_of_2, roundup_pow_of_two
+#include <asm/barrier.h> // smp_load_acquire, smp_store_release
+#include <linux/hrtimer.h> // struct hrtimer, ...
+#include <linux/atomic.h> // atomic_t, ...
+#include <linux/debugfs.h> // debugfs_create_dir, ...
+#include <linux/rtnetlink.h> // rtnl_lock, rtnl_unlock
+#include <linux/string.h> // memset
+#include <linux/mm.h> // kvzalloc_node, kvfree
+#include <linux/slab.h> // kcalloc, kfree
+#include <linux/jump_label.h> // DEFINE_STATIC_KEY_FALSE, static_branch_unlikely, ...
+#include <linux/timekeeping.h> // ktime_get_ns
+#include <linux/seq_file.h> // seq_printf, single_open, ...
+#include <linux/bitops.h> // fls64
 
 #define DRV_PREFIX "nic"
 #include "common.h"
+#include "pkt_trace.h"
+#include "vnic_queue.h"
+#include "poll_hist.h"
 
 #include "nic.h"
+#define CREATE_TRACE_POINTS // Defined here, & used by the driver as well
+#include "vnic_trace.h"
 
 #define NIC_NAPI_WEIGHT 64
+#define NIC_MAX_QUEUES 64
+#define NIC_MAX_NICS 256
 
 /* Following are the NIC Simulation related defines */
-#define NUM_TX_DESC 1024 /* Number of transmit descriptors */
-#define NUM_RX_DESC 1024 /* Number of receive descriptors */
+#define DEF_TX_DESC 1024 /* Default number of transmit descriptors. Should be a power of 2 */
+#define DEF_RX_DESC 1024 /* Default number of receive descriptors. Should be a power of 2 */
+#define MAX_COALESCE_USECS 10000 /* Max rx interrupt delay */
+#define DEF_COALESCE_USECS 0 /* Default rx interrupt delay => No time based coalescing */
+#define DEF_COALESCE_FRAMES 1 /* Default rx frames per interrupt => Interrupt per packet */
+#define RX_MAX_SEGS 64 /* Max segments of a super-pkt from the NIC end, in the descriptor mode */
+/* Min posted rx descriptors for the next pkt, below which the NIC end xmit queue is stopped */
+#define RX_STOP_THRESH (desc_mode ? RX_MAX_SEGS : 1)
+/* Posted rx descriptors to wake up the stopped NIC end xmit queue */
+#define RX_WAKE_THRESH(r) max_t(unsigned int, ((r)->mask + 1) / 4, RX_STOP_THRESH)
+#define LAT_BUCKETS 32 /* Latency histogram buckets: [2^(b-1), 2^b) ns for bucket b, w/ the last one open ended */
+#define OCC_BUCKETS 8 /* Occupancy histogram buckets: [b/8, (b+1)/8) of the ring for bucket b, w/ the last one closed */
+#define OCC_SAMPLE 16 /* Occupancy sampled once in these many posts */
 
-typedef struct _DrvPvt
+/*
+ * Descriptor ring, shared between the driver & the NIC, w/o any lock
+ *
+ * Three free running indices, each written only by its owner:
+ * prod is the descriptor to be posted next by the driver (tail register of a real NIC)
+ * done is the descriptor to be processed next by the NIC (head register of a real NIC)
+ * cons is the descriptor to be reaped next by the driver, after its processing by the NIC
+ * So, cons <= done <= prod (unsigned arithmetic takes care of the wrap around), & prod - cons <= size
+ * [done, prod) are owned by the NIC, & the rest by the driver
+ * Index into the descriptors = free running index & mask, as size is a power of 2
+ *
+ * Each index is on a separate cache line, alongwith its owner's snapshot of the index it chases,
+ * so that the sides on different cores don't keep bouncing a common cache line.
+ * A descriptor is handed over by a release store of the index moved past it, & is observed only after
+ * an acquire load of that index. Hence, no lock is needed between the sides.
+ *
+ * For the tx ring, driver's xmit posts, NIC's poll processes (transmits) & driver's poll reaps (cleans up).
+ * For the rx ring, driver's poll posts (refills), NIC's xmit processes (receives into) & driver's poll reaps.
+ */
+typedef struct _Ring
 {
-	struct net_device *ndev;
+	/* Owned by the driver's posting side */
+	unsigned int prod ____cacheline_aligned_in_smp;
+	unsigned int cons_snap; // Last seen value of cons
+	/* Owned by the NIC */
+	unsigned int done ____cacheline_aligned_in_smp;
+	unsigned int prod_snap; // Last seen value of prod
+	/* Owned by the driver's reaping side */
+	unsigned int cons ____cacheline_aligned_in_smp;
+	unsigned int done_snap; // Last seen value of done
+	/* Read only, once set up */
+	unsigned int mask ____cacheline_aligned_in_smp;
+	NicDesc *desc;
+} Ring;
+
+typedef struct _Nic DrvPvt; // Also, the NIC instance (Nic) of the NIC API
+
+/*
+ * Latency of the pkts sitting in a ring, from being posted into it till being taken out of it.
+ * Updated only by the side taking the pkts out, & hence w/o any lock. Read & reset as is, being only debug stats
+ */
+typedef struct _LatHist
+{
+	u64 buckets[LAT_BUCKETS];
+	u64 count;
+	u64 sum, min, max; // In ns
+} LatHist;
+
+/*
+ * Occupancy of a ring, sampled on posting into it: Mostly near full => The ring or its drain is too small.
+ * Updated only by the poster, & hence w/o any lock. Read & reset as is, being only debug stats
+ */
+typedef struct _OccHist
+{
+	u64 buckets[OCC_BUCKETS];
+	u64 count; // Samples
+	unsigned int skip; // Posts till the next sample
+} OccHist;
+
+typedef struct _NicQueue
+{
+	DrvPvt *pvt;
+	unsigned int qid;
 	struct napi_struct napi;
+	/* On separate cache lines, as updated by the xmit & the poll, which may run on different cores */
+	QueueStats tx_stats ____cacheline_aligned_in_smp;
+	OccHist rx_occ; // Along w/ the tx ones, as updated by the NIC end xmit, on receiving into the rx ring
+	QueueStats rx_stats ____cacheline_aligned_in_smp;
+	PollHist poll_hist; // Along w/ the rx ones, as updated by the poll only
 
 	/* Following are the NIC Simulation related fields */
-	spinlock_t lock; // Protect the following buffers & handler related fields
 	// Note: Define anything below in such a way that its value of zero indicates its default value
+	Ring tx_ring, rx_ring;
+	NicDesc *tx_desc, *rx_desc; // Allocated only while the buffers are set up
+
 	/*
-	 * tx_drv is the current index to be filled by driver for transmit
-	 * tx_nic is the current index to be transmitted by the NIC
-	 * tx_nic == tx_drv => Ring buffer empty
-	 * tx_drv one position behind tx_nic => Ring buffer full (we'll always keep one index free, even on full)
-	 * 	i.e. ((tx_nic - (tx_drv + 1) + NUM_TX_DESC) % NUM_TX_DESC == 0)
-	 * Count of pkts in the ring buffer = (tx_drv - tx_nic + NUM_TX_DESC) % NUM_TX_DESC;
-	 *
-	 * rx_drv is the current index to be picked by driver for receive
-	 * rx_nic is the current index to be received by the NIC
-	 * rx_drv == rx_nic => Ring buffer empty
-	 * rx_nic one position behind rx_drv => Ring buffer full (we'll always keep one index free, even on full)
-	 * 	i.e. ((rx_drv - (rx_nic + 1) + NUM_RX_DESC) % NUM_RX_DESC == 0)
-	 * Count of pkts in the ring buffer = (rx_nic - rx_drv + NUM_RX_DESC) % NUM_RX_DESC;
+	 * Following are set only while the NIC is not ready,
+	 * & hence need no protection on being used while the NIC is ready
 	 */
-	int tx_drv, tx_nic, rx_drv, rx_nic;
-	struct sk_buff *tx_ring_buffer[NUM_TX_DESC];
-	struct sk_buff *rx_ring_buffer[NUM_RX_DESC];
-
 	void *handler_param; // Parameter to be passed to handler
 	Handler handler;
 
+	int nic_intr_enabled; // NIC level interrupt of this queue is enabled or not
+	/*
+	 * Interrupt coalescing related fields:
+	 * intr_pending counts the pkts put into the rx ring since the last interrupt,
+	 * & intr_timer fires the interrupt for them, if the frames threshold is not crossed in time
+	 */
+	atomic_t intr_pending;
+	struct hrtimer intr_timer;
+
+	/* Counters updated only by the tx ring poster, i.e. the driver xmit */
+	u64 tx_pkts; // Pkts posted into the tx ring
+	u64 tx_doorbells; // Doorbells rung for them
+	OccHist tx_occ; // Of the tx ring, on posting the pkts
+
+	/*
+	 * Pkts reaped from the rx ring, yet to be completed to the NIC end xmit queue.
+	 * Updated only by the rx ring reaper, i.e. the driver poll
+	 */
+	unsigned int rx_done_pkts, rx_done_bytes;
+
+	/*
+	 * Pipeline latency, w/ the latency stats on:
+	 * tx_lat from the driver xmit posting into the tx ring till the NIC poll picking up,
+	 * rx_lat from the NIC end xmit receiving into the rx ring till the driver poll reaping
+	 */
+	LatHist tx_lat ____cacheline_aligned_in_smp;
+	LatHist rx_lat ____cacheline_aligned_in_smp;
+} NicQueue;
+
+struct _Nic
+{
+	struct net_device *ndev;
+	unsigned int index; // Of this NIC, from 0 to num_nics - 1
+
 	/*
 	 * Indicates if this NIC is initialized or not.
 	 * All NIC operations should depend on this. Why?
 	 * Because NIC is intialized means everything else is assumed to be setup.
-	 * Moreover, these should not be protected by spinlock in general, as these indicate hw state
+	 * Moreover, these should not be protected by any lock in general, as these indicate hw state
 	 */
 	int nic_ready;
-	int nic_intr_enabled; // NIC level interrupt is enabled or not
-} DrvPvt;
+	/*
+	 * Rx interrupt coalescing parameters, applicable to all the queues.
+	 * Interrupt is raised once coalesce_frames pkts are received (if non-zero),
+	 * or coalesce_usecs after the first pkt received (if non-zero), whichever is earlier
+	 */
+	unsigned int coalesce_usecs;
+	unsigned int coalesce_frames;
+	/* Ring sizes (powers of 2), applicable to all the queues. Take effect from the next buffers set up */
+	unsigned int tx_ring_size;
+	unsigned int rx_ring_size;
+	int rx_tstamp; // Timestamp the rx descriptors on receiving into them, or not
+
+	struct dentry *dbg_dir; // Debugfs directory of this NIC
 
-static DrvPvt *npvt;
+	unsigned int num_queues;
+	NicQueue queues[]; // One tx/rx ring pair, interrupt & napi per queue
+};
+
+static unsigned int num_queues; // 0 => One per online CPU
+module_param(num_queues, uint, 0444);
+MODULE_PARM_DESC(num_queues, "Number of tx/rx queue pairs (default: number of online CPUs)");
+static bool desc_mode; // false => VNIC Hack of handing over the skbs through the descriptors
+module_param(desc_mode, bool, 0444);
+MODULE_PARM_DESC(desc_mode, "Copy the pkts through the descriptor buffers, instead of handing over the skbs");
+
+static bool threaded; // false => NAPI polls in the softirq
+module_param(threaded, bool, 0444);
+MODULE_PARM_DESC(threaded, "Poll in the per napi kthreads, instead of the softirq (also, /sys/class/net/<if>/threaded)");
+
+static unsigned int num_nics = 1;
+module_param(num_nics, uint, 0444);
+MODULE_PARM_DESC(num_nics, "Number of NICs, each to be paired w/ an interface of the driver (default: 1)");
+
+static DrvPvt **npvts; // Hack using global array in absence of a horizontal layer (bus) to find the NICs
+static struct dentry *dbg_root; // Debugfs directory of all the NICs
+/* Latency stats, toggled through <debugfs>/vnic/latency. Off => Just a patched out branch in the fast paths */
+static DEFINE_STATIC_KEY_FALSE(lat_on);
+
+/* Following are the NIC Simulation related descriptor ring operations */
+static inline void ring_init(Ring *r, NicDesc *desc, unsigned int size)
+{
+	r->prod = r->cons_snap = 0;
+	r->done = r->prod_snap = 0;
+	r->cons = r->done_snap = 0;
+	r->mask = size - 1;
+	r->desc = desc;
+	memset(r->desc, 0, size * sizeof(NicDesc));
+}
+static inline unsigned int ring_pending(Ring *r) // Posted, yet to be processed. Exact only for the NIC
+{
+	return smp_load_acquire(&r->prod) - READ_ONCE(r->done);
+}
+static inline unsigned int ring_reapable(Ring *r) // Processed, yet to be reaped. Exact only for the reaper
+{
+	return smp_load_acquire(&r->done) - READ_ONCE(r->cons);
+}
+static inline unsigned int ring_room(Ring *r) // To be invoked only by the poster, or approximate
+{
+	return r->mask + 1 - (READ_ONCE(r->prod) - smp_load_acquire(&r->cons));
+}
+// To be invoked only by the poster. tstamp is set into each descriptor
+static inline int ring_post(Ring *r, const NicDesc *desc, unsigned int n, u64 tstamp)
+{
+	unsigned int prod = r->prod;
+	NicDesc *d;
+	int i;
+
+	if (prod + n - r->cons_snap > r->mask + 1) // Looks no room. Check again w/ the latest cons
+	{
+		r->cons_snap = smp_load_acquire(&r->cons);
+		if (prod + n - r->cons_snap > r->mask + 1) // No room
+		{
+			return -1;
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		d = &r->desc[(prod + i) & r->mask];
+		*d = desc[i];
+		d->flags &= ~NIC_DESC_DONE;
+		d->tstamp = tstamp;
+	}
+	smp_store_release(&r->prod, prod + n); // Hand over the descriptors to the NIC, all together
+	return 0;
+}
+static inline NicDesc *ring_fetch(Ring *r, unsigned int i) // To be invoked only by the NIC. i-th one to be processed
+{
+	unsigned int done = r->done;
+
+	if (r->prod_snap - done <= i) // Looks not posted. Check again w/ the latest prod
+	{
+		r->prod_snap = smp_load_acquire(&r->prod);
+		if (r->prod_snap - done <= i) // Not posted
+		{
+			return NULL;
+		}
+	}
+	return &r->desc[(done + i) & r->mask];
+}
+static inline void ring_fetched(Ring *r, unsigned int n) // To be invoked only by the NIC, on being through w/ n
+{
+	unsigned int done = r->done;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		r->desc[(done + i) & r->mask].flags |= NIC_DESC_DONE;
+	}
+	smp_store_release(&r->done, done + n); // Hand back the descriptors to the driver
+}
+static inline int ring_reap(Ring *r, NicDesc *desc) // To be invoked only by the reaper
+{
+	unsigned int cons = r->cons;
+
+	if (cons == r->done_snap) // Looks nothing processed. Check again w/ the latest done
+	{
+		r->done_snap = smp_load_acquire(&r->done);
+		if (cons == r->done_snap) // Nothing processed
+		{
+			return -1;
+		}
+	}
+	*desc = r->desc[cons & r->mask];
+	smp_store_release(&r->cons, cons + 1); // Make room for the poster
+	return 0;
+}
+static inline int ring_reclaim(Ring *r, NicDesc *desc) // To be invoked only while the NIC is not ready
+{
+	if (r->cons == r->prod)
+	{
+		return -1;
+	}
+	*desc = r->desc[r->cons++ & r->mask];
+	return 0;
+}
 
 static void display_packet(struct sk_buff *skb)
 {
@@ -151,309 +401,1052 @@ static void display_packet(struct sk_buff *skb)
 	}
 }
 
+static inline int nic_occ_sample(OccHist *h) // Non-zero => This post is to be sampled
+{
+	if (h->skip)
+	{
+		h->skip--;
+		return 0;
+	}
+	h->skip = OCC_SAMPLE - 1;
+	return 1;
+}
+static inline void nic_occ_add(OccHist *h, Ring *r, unsigned int occ) // occ descriptors in use of the ring r
+{
+	h->buckets[min_t(unsigned int, occ * OCC_BUCKETS / (r->mask + 1), OCC_BUCKETS - 1)]++;
+	h->count++;
+}
+
+static inline u64 nic_lat_tstamp(void) // 0 => Not stamped, w/ the latency stats off
+{
+	return static_branch_unlikely(&lat_on) ? ktime_get_ns() : 0;
+}
+static inline void nic_lat_add(LatHist *h, u64 tstamp) // Of a pkt stamped w/ tstamp, being taken out now
+{
+	u64 ns;
+
+	if (!tstamp) // Posted w/ the latency stats off
+	{
+		return;
+	}
+	ns = ktime_get_ns() - tstamp;
+	h->buckets[min_t(unsigned int, fls64(ns), LAT_BUCKETS - 1)]++;
+	if ((!h->count) || (ns < h->min))
+	{
+		h->min = ns;
+	}
+	if (ns > h->max)
+	{
+		h->max = ns;
+	}
+	h->sum += ns;
+	h->count++;
+}
+
+static void nic_queue_reset(NicQueue *q) // Reset the rings & the related counters
+{
+	ring_init(&q->tx_ring, q->tx_desc, q->pvt->tx_ring_size);
+	ring_init(&q->rx_ring, q->rx_desc, q->pvt->rx_ring_size);
+	q->rx_done_pkts = q->rx_done_bytes = 0;
+}
+
+/* Following are the NIC Simulation related interrupt operations */
+static void nic_fire_intr(NicQueue *q)
+{
+	Handler handler;
+	unsigned int pkts = atomic_xchg(&q->intr_pending, 0); // Not to lose the ones counted in between
+
+	handler = READ_ONCE(q->handler);
+	// Fire only if enabled, & mask atomically, as the NIC end xmit, the NIC poll, the timer & the enable may race
+	if ((handler) && (xchg(&q->nic_intr_enabled, 0)))
+	{
+		trace_vnic_intr(q->pvt->ndev, q->qid, pkts);
+		(*handler)(q->handler_param);
+	}
+}
+static enum hrtimer_restart nic_intr_timer_fn(struct hrtimer *timer)
+{
+	NicQueue *q = container_of(timer, NicQueue, intr_timer);
+
+	nic_fire_intr(q);
+	return HRTIMER_NORESTART;
+}
+// VNIC Hack: Trigger the rx interrupt for the driver, as per the coalescing parameters
+static void nic_trigger_intr(NicQueue *q)
+{
+	DrvPvt *pvt = q->pvt;
+	unsigned int usecs = READ_ONCE(pvt->coalesce_usecs);
+	unsigned int frames = READ_ONCE(pvt->coalesce_frames);
+	int pending;
+
+	/*
+	 * Order the descriptors published (by the caller) w/ the check below, against the reverse order in
+	 * nic_hw_enable_intr(). Else, both may miss each other, leaving the pkts in the ring w/o any interrupt
+	 */
+	smp_mb();
+	if (!READ_ONCE(q->nic_intr_enabled)) // Masked. Would be raised on being enabled
+	{
+		return;
+	}
+	pending = atomic_inc_return(&q->intr_pending);
+	if ((!usecs) || ((frames) && (pending >= frames)))
+	{
+		if (usecs)
+		{
+			hrtimer_try_to_cancel(&q->intr_timer);
+		}
+		nic_fire_intr(q);
+	}
+	else if (pending == 1) // First pkt after the last interrupt. Start the timer for it
+	{
+		hrtimer_start(&q->intr_timer, ns_to_ktime((u64)(usecs) * NSEC_PER_USEC), HRTIMER_MODE_REL);
+	}
+}
+
 static int nic_open(struct net_device *dev)
 {
 	DrvPvt *pvt = netdev_priv(dev);
+	int i;
 
 	iprintk("open\n");
-	napi_enable(&pvt->napi);
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		napi_enable(&pvt->queues[i].napi);
+	}
+	/*
+	 * Drain the pkts posted by the driver while down, as their doorbells got swallowed by the disabled napis.
+	 * Else, a tx ring filled up meanwhile would keep the driver xmit queue stopped forever
+	 */
+	local_bh_disable(); // For the scheduled polls to run on enabling
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		if ((smp_load_acquire(&pvt->nic_ready)) && (ring_pending(&pvt->queues[i].tx_ring)))
+		{
+			napi_schedule(&pvt->queues[i].napi);
+		}
+	}
+	local_bh_enable();
 	return 0;
 }
 static int nic_close(struct net_device *dev)
 {
 	DrvPvt *pvt = netdev_priv(dev);
+	int i;
 
 	iprintk("close\n");
-	napi_disable(&pvt->napi);
-	// Clear the stats
-	memset(&dev->stats, 0, sizeof(dev->stats));
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		napi_disable(&pvt->queues[i].napi);
+		// Clear the stats
+		vnic_stats_clear(&pvt->queues[i].tx_stats);
+		vnic_stats_clear(&pvt->queues[i].rx_stats);
+	}
 	return 0;
 }
+// VNIC Hack: Receive the (non-super) pkt into the next posted rx descriptor, & trigger the rx interrupt for it
+static void nic_rx_put(NicQueue *q, struct netdev_queue *txq, struct sk_buff *skb)
+{
+	NicDesc *d;
+	int len = skb->len; // To avoid using skb after it is handed over
+
+	if (!(d = ring_fetch(&q->rx_ring, 0)))
+	{
+		vnic_stats_add(&q->tx_stats, 0, 0, 1);
+		dev_kfree_skb(skb);
+		return;
+	}
+	if (desc_mode)
+	{
+		// Leave the descriptor for the next pkt, if it doesn't fit into the rx buffer, or its offloads can't be described
+		if ((len > d->len) || (virtio_net_hdr_from_skb(skb, &d->hdr, true, true, 0)))
+		{
+			vnic_stats_add(&q->tx_stats, 0, 0, 1);
+			dev_kfree_skb(skb);
+			return;
+		}
+		skb_copy_bits(skb, 0, d->addr, len); // VNIC Hack: Receive into the rx buffer, as a DMA would
+		dev_consume_skb_any(skb);
+	}
+	else
+	{
+		d->skb = skb; // VNIC Hack: Hand over the skb itself, even if a super-pkt
+	}
+	d->len = len;
+	// Rx DMA timestamp, if asked for by the driver. Else, only for the latency stats
+	d->tstamp = READ_ONCE(q->pvt->rx_tstamp) ? ktime_get_ns() : nic_lat_tstamp();
+	netdev_tx_sent_queue(txq, len); // Before handing over, as its completion may follow right thereafter
+	ring_fetched(&q->rx_ring, 1);
+	if (nic_occ_sample(&q->rx_occ)) // Received, yet to be reaped by the driver, including this one
+	{
+		nic_occ_add(&q->rx_occ, &q->rx_ring, ring_reapable(&q->rx_ring));
+	}
+	if (trace_vnic_xmit_enabled())
+	{
+		trace_vnic_xmit(q->pvt->ndev, q->qid, len, 1, ring_pending(&q->rx_ring));
+	}
+	vnic_stats_add(&q->tx_stats, 1, len, 0);
+	nic_trigger_intr(q); // VNIC Hack: Trigger the rx interrupt for the driver
+}
 // VNIC Hack: For transmitting packets from the other end of the NIC
 static int nic_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	DrvPvt *pvt = netdev_priv(dev);
-	unsigned long flags;
+	NicQueue *q = &pvt->queues[skb_get_queue_mapping(skb)];
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, q->qid);
+	struct sk_buff *segs, *seg, *next;
 
-	iprintk("tx\n");
-	display_packet(skb);
+	tprintk("tx\n");
+	pkt_trace_display(skb);
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	if ((pvt->nic_ready) &&
-		((pvt->rx_drv - (pvt->rx_nic + 1) + NUM_RX_DESC) % NUM_RX_DESC != 0)) // Not Full
+	/*
+	 * Rx descriptors can't be all used up here, as the queue is stopped on that.
+	 * Dropping only if the driver end is not up, as then there is no one to get the pkts
+	 */
+	if (!smp_load_acquire(&pvt->nic_ready))
 	{
-		pvt->rx_ring_buffer[pvt->rx_nic] = skb;
-		pvt->rx_nic = (pvt->rx_nic + 1) % NUM_RX_DESC;
-		dev->stats.tx_packets++;
-		dev->stats.tx_bytes += skb->len;
-		if ((pvt->nic_intr_enabled) && (pvt->handler)) // VNIC Hack: Trigger the rx interrupt for the driver
+		vnic_stats_add(&q->tx_stats, 0, 0, 1);
+		dev_kfree_skb(skb);
+		return 0;
+	}
+
+	if ((desc_mode) && (skb_is_gso(skb))) // Doesn't fit into a rx buffer. So, segment it, as a TSO NIC on the wire
+	{
+		segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM); // Checksums still left to the offload
+		if (IS_ERR_OR_NULL(segs))
+		{
+			vnic_stats_add(&q->tx_stats, 0, 0, 1);
+			dev_kfree_skb(skb);
+			return 0;
+		}
+		dev_consume_skb_any(skb);
+		skb_list_walk_safe(segs, seg, next)
 		{
-			(*(pvt->handler))(pvt->handler_param);
+			skb_mark_not_on_list(seg);
+			nic_rx_put(q, txq, seg);
 		}
 	}
 	else
 	{
-		dev->stats.tx_dropped++;
-		dev_kfree_skb(skb);
+		nic_rx_put(q, txq, skb);
+	}
+
+	if (ring_pending(&q->rx_ring) < RX_STOP_THRESH) // Stop till the driver posts more rx descriptors
+	{
+		netif_tx_stop_queue(txq);
+		smp_mb(); // Order the stop above w/ the check below, against the reverse order in nic_hw_rx_kick()
+		if (ring_pending(&q->rx_ring) >= RX_WAKE_THRESH(&q->rx_ring)) // Got posted in between
+		{
+			netif_tx_start_queue(txq);
+		}
+		else
+		{
+			trace_vnic_ring_full(dev, q->qid, ring_pending(&q->rx_ring));
+		}
 	}
-	spin_unlock_irqrestore(&pvt->lock, flags);
 
 	return 0;
 }
+static void nic_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	u64 pkts, bytes, dropped;
+	int i;
+
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		vnic_stats_fetch(&pvt->queues[i].tx_stats, &pkts, &bytes, &dropped);
+		stats->tx_packets += pkts;
+		stats->tx_bytes += bytes;
+		stats->tx_dropped += dropped;
+		vnic_stats_fetch(&pvt->queues[i].rx_stats, &pkts, &bytes, &dropped);
+		stats->rx_packets += pkts;
+		stats->rx_bytes += bytes;
+		stats->rx_dropped += dropped;
+	}
+}
 
 static const struct net_device_ops nic_netdev_ops =
 {
 	.ndo_open = nic_open,
 	.ndo_stop = nic_close,
 	.ndo_start_xmit = nic_start_xmit,
+	.ndo_get_stats64 = nic_get_stats64,
 };
 
+/*
+ * VNIC Hack: Get the pkt transmitted from its n tx descriptors, as the skb for the stack on this end.
+ * Its checksum status is as in the driver: W/ NETIF_F_RXCSUM, CHECKSUM_PARTIAL is passed up as is, as veth does,
+ * & the one validated before its transmission as CHECKSUM_UNNECESSARY. W/o it, the checksum gets filled in
+ */
+static struct sk_buff *nic_rx_skb(NicQueue *q, unsigned int n, unsigned int len)
+{
+	struct net_device *dev = q->pvt->ndev;
+	struct sk_buff *skb;
+	NicDesc *d;
+	int i;
+
+	if (desc_mode) // Transmit from the tx buffers, as a DMA would, into a new skb
+	{
+		if (!(skb = napi_alloc_skb(&q->napi, len)))
+		{
+			return NULL;
+		}
+		for (i = 0; i < n; i++)
+		{
+			d = ring_fetch(&q->tx_ring, i);
+			skb_put_data(skb, d->addr, d->len);
+		}
+		d = ring_fetch(&q->tx_ring, 0); // First one has the offloads
+		if (d->hdr.flags & VIRTIO_NET_HDR_F_DATA_VALID)
+		{
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+		}
+		if (virtio_net_hdr_to_skb(skb, &d->hdr, true)) // Offsets therein are from the Ethernet header
+		{
+			dev_kfree_skb(skb);
+			return NULL;
+		}
+		skb->protocol = eth_type_trans(skb, dev);
+	}
+	else // Take over the skb itself (in the only descriptor), & scrub it for this end, as veth does
+	{
+		d = ring_fetch(&q->tx_ring, 0);
+		skb = d->skb;
+		d->skb = NULL;
+		skb_scrub_packet(skb, !net_eq(dev_net(dev), dev_net(skb->dev)));
+		skb->priority = 0;
+		skb->protocol = eth_type_trans(skb, dev);
+	}
+	if ((!(dev->features & NETIF_F_RXCSUM)) && (!skb_is_gso(skb))) // Super-pkt can only be CHECKSUM_PARTIAL
+	{
+		if ((skb->ip_summed == CHECKSUM_PARTIAL) && (skb_checksum_help(skb)))
+		{
+			dev_kfree_skb(skb);
+			return NULL;
+		}
+		skb->ip_summed = CHECKSUM_NONE;
+	}
+	return skb;
+}
+
 // VNIC Hack: For receiving packets on the other end of the NIC
 static int nic_poll(struct napi_struct *napi_ptr, int budget)
 {
-	DrvPvt *pvt = container_of(napi_ptr, DrvPvt, napi);
-	struct net_device *dev = pvt->ndev;
-	unsigned long flags;
-	struct sk_buff *skb = NULL;
+	NicQueue *q = container_of(napi_ptr, NicQueue, napi);
+	DrvPvt *pvt = q->pvt;
+	struct sk_buff *skb;
+	NicDesc *d;
+	unsigned int n;
 	int pkt_size;
-	unsigned int work_done;
+	int work_done;
+	unsigned int pkts, bytes, dropped;
+	u64 tstamp;
 
-	iprintk("poll\n");
+	tprintk("poll\n");
+	trace_vnic_poll_start(pvt->ndev, q->qid, budget);
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	if (pvt->tx_nic != pvt->tx_drv) // Not Empty
+	work_done = 0;
+	pkts = bytes = dropped = 0;
+	// If not ready, most probably all buffers were cleared due to close from the driver
+	if (smp_load_acquire(&pvt->nic_ready))
 	{
-		skb = pvt->tx_ring_buffer[pvt->tx_nic];
-		pvt->tx_ring_buffer[pvt->tx_nic] = NULL;
-		pvt->tx_nic = (pvt->tx_nic + 1) % NUM_TX_DESC;
-		// VNIC Hack: Get size of the pkt received on the other end of the NIC
-		pkt_size = skb->len;
+		while ((work_done < budget) && (d = ring_fetch(&q->tx_ring, 0)))
+		{
+			tstamp = d->tstamp; // Of posting, if stamped
+			if (static_branch_unlikely(&lat_on))
+			{
+				nic_lat_add(&q->tx_lat, tstamp);
+			}
+			/*
+			 * VNIC Hack: Get the descriptors & size of the pkt received on the other end of the NIC.
+			 * All the descriptors of a pkt are posted together. So, all are there, if the first one is
+			 */
+			for (n = 1, pkt_size = d->len; !(d->flags & NIC_DESC_EOP); n++)
+			{
+				d = ring_fetch(&q->tx_ring, n);
+				pkt_size += d->len;
+			}
+			skb = nic_rx_skb(q, n, pkt_size);
+			if (d->flags & NIC_DESC_TSTAMP) // On the wire now. So, write back the timestamp into the last one
+			{
+				d->tstamp = ktime_get_ns();
+			}
+			ring_fetched(&q->tx_ring, n); // Transmitted. So, the driver may clean them up
+			work_done++;
+			if (!skb)
+			{
+				dropped++;
+				continue;
+			}
+			pkt_trace_display(skb);
+			pkts++;
+			bytes += pkt_size;
+			skb_record_rx_queue(skb, q->qid);
+			trace_vnic_rx(pvt->ndev, q->qid, skb->len, tstamp);
+			napi_gro_receive(&q->napi, skb); // Handover to the network stack
+		}
 	}
-	spin_unlock_irqrestore(&pvt->lock, flags);
 
-	if (!skb) // Most probably all buffers were cleared due to close from the driver
+	if (work_done) // VNIC Hack: Trigger the tx completion interrupt for the driver
 	{
-		dev->stats.rx_errors++;
+		vnic_stats_add(&q->rx_stats, pkts, bytes, dropped);
+		nic_trigger_intr(q);
 	}
-	else
+
+	if (work_done < budget) // Ring drained
 	{
-		display_packet(skb);
-		dev->stats.rx_packets++;
-		dev->stats.rx_bytes += pkt_size;
-		//skb_put(skb, pkt_size); // VNIC Hack: Not to be done here as it is already set
-		//skb->protocol = eth_type_trans(skb, dev); // VNIC Hack: Not needed here as it is already set
-		napi_gro_receive(&pvt->napi, skb); // Handover to the network stack
+		/*
+		 * A doorbell rung after the ring got found empty above, but before the completion here,
+		 * would have found the napi still scheduled, & hence got lost. So, re-check the ring after
+		 * the completion (which orders w/ the doorbell's napi state check), & reschedule if needed
+		 */
+		if ((napi_complete_done(napi_ptr, work_done)) && (ring_pending(&q->tx_ring)) &&
+			(smp_load_acquire(&pvt->nic_ready)))
+		{
+			napi_schedule(napi_ptr);
+		}
 	}
+	poll_hist_add(&q->poll_hist, work_done, budget);
+	trace_vnic_poll_end(pvt->ndev, q->qid, work_done, budget);
 
-	work_done = 1; // VNIC Hack: As currently napi is being scheduled for every packet received
-	if (work_done < budget)
+	return work_done;
+}
+
+static u64 nic_lat_pct(const LatHist *h, unsigned int per_mille) // Upper bound of its bucket, in ns
+{
+	u64 rank = div_u64(h->count * per_mille + 999, 1000), seen = 0;
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS - 1; b++)
 	{
-		napi_complete(napi_ptr);
+		if ((seen += h->buckets[b]) >= rank)
+		{
+			break;
+		}
 	}
-	// TODO: This function may be enhanced to process packets till budget.
-	// Just that there would be redundant napi schedules, which would come here & complete
+	return (b < LAT_BUCKETS - 1) ? (1ULL << b) - 1 : U64_MAX;
+}
+static int nic_lat_show(struct seq_file *s, void *v)
+{
+	LatHist h = *(LatHist *)(s->private); // Snapshot, as may be getting updated
+	static const unsigned int pcts[] = { 500, 900, 990, 999 };
+	int i, b;
 
-	return work_done;
+	seq_printf(s, "count: %llu\n", h.count);
+	if (!h.count)
+	{
+		return 0;
+	}
+	seq_printf(s, "min: %llu ns, avg: %llu ns, max: %llu ns\n", h.min, div64_u64(h.sum, h.count), h.max);
+	for (i = 0; i < ARRAY_SIZE(pcts); i++)
+	{
+		if (nic_lat_pct(&h, pcts[i]) == U64_MAX)
+		{
+			// In the open ended last bucket, & hence bounded only by the max
+			seq_printf(s, "p%u.%u: >= %llu ns, <= %llu ns\n", pcts[i] / 10, pcts[i] % 10,
+				1ULL << (LAT_BUCKETS - 2), h.max);
+		}
+		else
+		{
+			seq_printf(s, "p%u.%u: < %llu ns\n", pcts[i] / 10, pcts[i] % 10, nic_lat_pct(&h, pcts[i]) + 1);
+		}
+	}
+	for (b = 0; b < LAT_BUCKETS; b++)
+	{
+		if (!h.buckets[b])
+		{
+			continue;
+		}
+		if (b < LAT_BUCKETS - 1)
+		{
+			seq_printf(s, "[%llu, %llu) ns: %llu\n", b ? 1ULL << (b - 1) : 0, 1ULL << b, h.buckets[b]);
+		}
+		else
+		{
+			seq_printf(s, ">= %llu ns: %llu\n", 1ULL << (b - 1), h.buckets[b]);
+		}
+	}
+	return 0;
 }
+static int nic_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nic_lat_show, inode->i_private);
+}
+static ssize_t nic_lat_write(struct file *file, const char __user *buf, size_t len, loff_t *off) // Reset
+{
+	LatHist *h = ((struct seq_file *)(file->private_data))->private;
 
-static int nic_init(void)
+	memset(h, 0, sizeof(*h));
+	return len;
+}
+static const struct file_operations nic_lat_fops =
+{
+	.owner = THIS_MODULE,
+	.open = nic_lat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = nic_lat_write,
+	.release = single_release,
+};
+static int nic_occ_show(struct seq_file *s, void *v)
+{
+	OccHist h = *(OccHist *)(s->private); // Snapshot, as may be getting updated
+	int b;
+
+	seq_printf(s, "samples: %llu (1 in %u posts)\n", h.count, OCC_SAMPLE);
+	for (b = 0; b < OCC_BUCKETS; b++)
+	{
+		if (h.buckets[b])
+		{
+			seq_printf(s, "[%u%%, %u%%%c: %llu\n", b * 100 / OCC_BUCKETS, (b + 1) * 100 / OCC_BUCKETS,
+				(b < OCC_BUCKETS - 1) ? ')' : ']', h.buckets[b]);
+		}
+	}
+	return 0;
+}
+static int nic_occ_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nic_occ_show, inode->i_private);
+}
+static ssize_t nic_occ_write(struct file *file, const char __user *buf, size_t len, loff_t *off) // Reset
+{
+	OccHist *h = ((struct seq_file *)(file->private_data))->private;
+
+	memset(h, 0, sizeof(*h));
+	return len;
+}
+static const struct file_operations nic_occ_fops =
+{
+	.owner = THIS_MODULE,
+	.open = nic_occ_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = nic_occ_write,
+	.release = single_release,
+};
+static ssize_t nic_lat_on_read(struct file *file, char __user *buf, size_t len, loff_t *off)
+{
+	char c[2] = { static_key_enabled(&lat_on) ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(buf, len, off, c, sizeof(c));
+}
+static ssize_t nic_lat_on_write(struct file *file, const char __user *buf, size_t len, loff_t *off)
+{
+	bool on;
+	int ret;
+
+	if ((ret = kstrtobool_from_user(buf, len, &on)))
+	{
+		return ret;
+	}
+	if (on)
+	{
+		static_branch_enable(&lat_on);
+	}
+	else
+	{
+		static_branch_disable(&lat_on);
+	}
+	return len;
+}
+static const struct file_operations nic_lat_on_fops =
+{
+	.owner = THIS_MODULE,
+	.read = nic_lat_on_read,
+	.write = nic_lat_on_write,
+	.llseek = default_llseek,
+};
+
+static void nic_debugfs_init(DrvPvt *pvt)
+{
+	struct dentry *qdir;
+	char name[16];
+	int i;
+
+	pvt->dbg_dir = debugfs_create_dir(pvt->ndev->name, dbg_root);
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		snprintf(name, sizeof(name), "q%d", i);
+		qdir = debugfs_create_dir(name, pvt->dbg_dir);
+		debugfs_create_u64("tx_pkts", 0444, qdir, &pvt->queues[i].tx_pkts);
+		debugfs_create_u64("tx_doorbells", 0444, qdir, &pvt->queues[i].tx_doorbells);
+		// Writing anything resets
+		debugfs_create_file("tx_latency", 0644, qdir, &pvt->queues[i].tx_lat, &nic_lat_fops);
+		debugfs_create_file("rx_latency", 0644, qdir, &pvt->queues[i].rx_lat, &nic_lat_fops);
+		debugfs_create_file("tx_occupancy", 0644, qdir, &pvt->queues[i].tx_occ, &nic_occ_fops);
+		debugfs_create_file("rx_occupancy", 0644, qdir, &pvt->queues[i].rx_occ, &nic_occ_fops);
+		debugfs_create_file("work_done", 0644, qdir, &pvt->queues[i].poll_hist, &poll_hist_fops);
+	}
+}
+static void nic_debugfs_shut(DrvPvt *pvt)
+{
+	debugfs_remove_recursive(pvt->dbg_dir);
+}
+
+static DrvPvt *nic_dev_create(unsigned int index)
 {
 	struct net_device *dev;
 	DrvPvt *pvt;
-	int ret;
+	NicQueue *q;
+	unsigned int nq;
+	int i, ret;
 
-	iprintk("init\n");
+	nq = num_queues ? num_queues : num_online_cpus();
+	if (nq > NIC_MAX_QUEUES)
+	{
+		wprintk("limiting to %u queues\n", NIC_MAX_QUEUES);
+		nq = NIC_MAX_QUEUES;
+	}
 
-	dev = alloc_netdev(sizeof(DrvPvt), "nic", NET_NAME_UNKNOWN, ether_setup);
+	// Named nic, as ever, if only one. Else, nic0, nic1, ...
+	dev = alloc_netdev_mqs(struct_size(pvt, queues, nq), (num_nics == 1) ? "nic" : "nic%d", NET_NAME_UNKNOWN,
+				ether_setup, nq, nq);
 	if (!dev)
 	{
 		eprintk("device allocation failed\n");
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 	}
 	pvt = netdev_priv(dev);
 	pvt->ndev = dev;
-	netif_napi_add(dev, &pvt->napi, nic_poll, NIC_NAPI_WEIGHT);
-	// Setting up some MAC Addr - 00:56:4E:49:43:53 to be specific
+	pvt->index = index;
+	pvt->num_queues = nq;
+	for (i = 0; i < nq; i++)
+	{
+		q = &pvt->queues[i];
+		q->pvt = pvt;
+		q->qid = i;
+		netif_napi_add(dev, &q->napi, nic_poll, NIC_NAPI_WEIGHT);
+		u64_stats_init(&q->tx_stats.syncp);
+		u64_stats_init(&q->rx_stats.syncp);
+		hrtimer_init(&q->intr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		q->intr_timer.function = nic_intr_timer_fn;
+	}
+	// Setting up some MAC Addr - 00:56:4E:49:43:53 to be specific, w/ the last byte incremented per NIC
 	memcpy(dev->dev_addr, "\0VNICS", 6); // Virtual NIC Simulation
+	dev->dev_addr[5] += index;
 	dev->netdev_ops = &nic_netdev_ops;
+	// Offloads, which can be toggled w/ ethtool -K. Super-pkts need scatter-gather
+	dev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_RXCSUM | NETIF_F_GSO_SOFTWARE;
+	dev->features = dev->hw_features;
+	if (desc_mode) // Super-pkts get segmented into the rx buffers. So, limit the descriptors needed
+	{
+		dev->gso_max_segs = RX_MAX_SEGS;
+	}
+
+	/* Following are the NIC Simulation related initializations */
+	/* Should be done before registration, as xmit may get invoked any time thereafter */
+	pvt->nic_ready = 0;
+	pvt->coalesce_usecs = DEF_COALESCE_USECS;
+	pvt->coalesce_frames = DEF_COALESCE_FRAMES;
+	pvt->tx_ring_size = DEF_TX_DESC;
+	pvt->rx_ring_size = DEF_RX_DESC;
+
 	if ((ret = register_netdev(dev)))
 	{
 		eprintk("%s network interface registration failed w/ error %i\n", dev->name, ret);
+		for (i = 0; i < nq; i++)
+		{
+			netif_napi_del(&pvt->queues[i].napi);
+		}
 		free_netdev(dev);
+		return ERR_PTR(ret);
 	}
-	else
+	vnic_set_xps(dev, pvt->num_queues); // Default, once. Thereafter, as set by the admin, if at all
+	// Schedulable & affinable like any task, instead of competing w/ the rest of the softirq work on the core
+	if (threaded)
 	{
-		npvt = pvt; // Hack using global variable in absence of a horizontal layer
+		rtnl_lock(); // As for any change of the napis' state, e.g. through the sysfs
+		ret = dev_set_threaded(dev, true);
+		rtnl_unlock();
+		if (ret)
+		{
+			wprintk("%s threaded napi failed. Continuing w/ the softirq\n", dev->name);
+		}
 	}
+	nic_debugfs_init(pvt);
+	iprintk("%s registered w/ %u queue(s)\n", dev->name, nq);
 
-	/* Following are the NIC Simulation related initializations */
-	spin_lock_init(&pvt->lock);
-	pvt->nic_ready = 0;
-
-	return ret;
+	return pvt;
 }
-static void nic_exit(void)
+static void nic_dev_destroy(DrvPvt *pvt)
 {
-	DrvPvt *pvt = npvt;
 	struct net_device *dev = pvt->ndev;
-
-	iprintk("exit\n");
+	int i;
 
 	/* Following are the NIC Simulation related cleanups */
-	/* None required */
+	nic_debugfs_shut(pvt);
 
 	unregister_netdev(dev);
-	netif_napi_del(&pvt->napi);
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		netif_napi_del(&pvt->queues[i].napi);
+		hrtimer_cancel(&pvt->queues[i].intr_timer); // Armed by the NIC end xmit, even w/o the driver
+	}
 	free_netdev(dev);
 }
 
+static int nic_init(void)
+{
+	DrvPvt *pvt;
+	int i;
+
+	BUILD_BUG_ON(!is_power_of_2(DEF_TX_DESC));
+	BUILD_BUG_ON(!is_power_of_2(DEF_RX_DESC));
+
+	iprintk("init\n");
+
+	if ((num_nics < 1) || (num_nics > NIC_MAX_NICS))
+	{
+		eprintk("num_nics should be from 1 to %u\n", NIC_MAX_NICS);
+		return -EINVAL;
+	}
+	if (!(npvts = kcalloc(num_nics, sizeof(*npvts), GFP_KERNEL)))
+	{
+		return -ENOMEM;
+	}
+	dbg_root = debugfs_create_dir("vnic", NULL);
+	debugfs_create_file("latency", 0644, dbg_root, NULL, &nic_lat_on_fops);
+	for (i = 0; i < num_nics; i++)
+	{
+		pvt = nic_dev_create(i);
+		if (IS_ERR(pvt))
+		{
+			while (i--)
+			{
+				nic_dev_destroy(npvts[i]);
+			}
+			debugfs_remove_recursive(dbg_root);
+			kfree(npvts);
+			return PTR_ERR(pvt);
+		}
+		npvts[i] = pvt;
+	}
+
+	return 0;
+}
+static void nic_exit(void)
+{
+	int i;
+
+	iprintk("exit\n");
+
+	for (i = 0; i < num_nics; i++)
+	{
+		nic_dev_destroy(npvts[i]);
+	}
+	debugfs_remove_recursive(dbg_root);
+	kfree(npvts);
+}
+
 module_init(nic_init);
 module_exit(nic_exit);
 
-/* Following are the NIC Simulation related functions */
-void nic_setup_buffers(void)
+/*
+ * Following are the NIC Simulation related functions
+ * Set up & clean up are to be invoked only while the NIC is not ready,
+ * i.e. before nic_hw_init() & after nic_hw_shut(), as nothing else touches the rings then
+ */
+unsigned int nic_hw_num_nics(void)
+{
+	return num_nics;
+}
+Nic *nic_hw_get(unsigned int index) // For the driver to pair w/ it. NULL, if none
+{
+	return (index < num_nics) ? npvts[index] : NULL;
+}
+unsigned int nic_hw_num_queues(Nic *nic)
+{
+	DrvPvt *pvt = nic;
+
+	return pvt->num_queues;
+}
+int nic_hw_desc_mode(Nic *nic)
+{
+	return desc_mode;
+}
+int nic_setup_buffers(Nic *nic) // Allocates the rings, local to the device's NUMA node
+{
+	DrvPvt *pvt = nic;
+	int node = dev_to_node(&pvt->ndev->dev);
+	NicQueue *q;
+	int i;
+
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		q = &pvt->queues[i];
+		q->tx_desc = kvzalloc_node(array_size(pvt->tx_ring_size, sizeof(NicDesc)), GFP_KERNEL, node);
+		q->rx_desc = kvzalloc_node(array_size(pvt->rx_ring_size, sizeof(NicDesc)), GFP_KERNEL, node);
+		if (!q->tx_desc || !q->rx_desc)
+		{
+			eprintk("ring allocation failed\n");
+			nic_cleanup_buffers(nic);
+			return -ENOMEM;
+		}
+		nic_queue_reset(q);
+	}
+	return 0;
+}
+void nic_cleanup_buffers(Nic *nic) // Buffers, if any, are expected to be already reclaimed by the driver
+{
+	DrvPvt *pvt = nic;
+	NicQueue *q;
+	struct netdev_queue *txq;
+	int i;
+
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		q = &pvt->queues[i];
+		kvfree(q->tx_desc);
+		kvfree(q->rx_desc);
+		q->tx_desc = q->rx_desc = NULL;
+		/*
+		 * NIC end xmit queue may be stopped for the rx ring just cleared, & its BQL be awaiting
+		 * completions for those pkts. So, reset & wake it up, under its lock, as the NIC end is independent
+		 */
+		txq = netdev_get_tx_queue(pvt->ndev, i);
+		__netif_tx_lock_bh(txq);
+		netdev_tx_reset_queue(txq);
+		netif_tx_wake_queue(txq);
+		__netif_tx_unlock_bh(txq);
+	}
+}
+void nic_register_handler(Nic *nic, unsigned int qid, Handler handler, void *handler_param)
+{
+	NicQueue *q = &nic->queues[qid];
+
+	WRITE_ONCE(q->handler_param, handler_param);
+	WRITE_ONCE(q->handler, handler);
+}
+void nic_unregister_handler(Nic *nic, unsigned int qid)
+{
+	NicQueue *q = &nic->queues[qid];
+
+	WRITE_ONCE(q->handler, NULL);
+	WRITE_ONCE(q->handler_param, NULL);
+}
+
+void nic_hw_enable_intr(Nic *nic, unsigned int qid)
+{
+	NicQueue *q = &nic->queues[qid];
+
+	WRITE_ONCE(q->nic_intr_enabled, 1);
+	/*
+	 * VNIC Hack: Check for pending interrupt by checking the received & the transmitted descriptors
+	 * yet to be reaped, & call handler, if pending.
+	 * Needed, as the pkts received while masked don't trigger any interrupt
+	 */
+	smp_mb(); // Order the enable above w/ the check below, against the reverse order in nic_trigger_intr()
+	if ((ring_reapable(&q->rx_ring)) || (ring_reapable(&q->tx_ring)))
+	{
+		nic_fire_intr(q);
+	}
+}
+void nic_hw_disable_intr(Nic *nic, unsigned int qid)
+{
+	NicQueue *q = &nic->queues[qid];
+
+	WRITE_ONCE(q->nic_intr_enabled, 0);
+}
+void nic_hw_init(Nic *nic)
 {
-	DrvPvt *pvt = npvt;
-	unsigned long flags;
+	DrvPvt *pvt = nic;
 	int i;
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	pvt->tx_drv = pvt->tx_nic = 0;
-	for (i = 0; i < NUM_TX_DESC; i++)
+	smp_store_release(&pvt->nic_ready, 1); // Makes all the set up visible before the NIC gets ready
+	for (i = 0; i < pvt->num_queues; i++)
 	{
-		pvt->tx_ring_buffer[i] = NULL;
+		nic_hw_enable_intr(nic, i);
 	}
-	pvt->rx_drv = pvt->rx_nic = 0;
-	for (i = 0; i < NUM_RX_DESC; i++)
+}
+void nic_hw_shut(Nic *nic)
+{
+	DrvPvt *pvt = nic;
+	int i;
+
+	for (i = 0; i < pvt->num_queues; i++)
 	{
-		pvt->rx_ring_buffer[i] = NULL;
+		nic_hw_disable_intr(nic, i);
+	}
+	WRITE_ONCE(pvt->nic_ready, 0);
+	/*
+	 * Wait for the xmits & polls (all running w/ bh disabled) already past the ready check,
+	 * so that the rings are left only to the clean up thereafter
+	 */
+	synchronize_net();
+	for (i = 0; i < pvt->num_queues; i++) // Only now, as could have been re-armed by the ones waited for above
+	{
+		hrtimer_cancel(&pvt->queues[i].intr_timer);
 	}
-	spin_unlock_irqrestore(&pvt->lock, flags);
 }
-void nic_cleanup_buffers(void) // Free all non-processed skbs
+
+void nic_hw_get_coalesce(Nic *nic, unsigned int *usecs, unsigned int *frames)
 {
-	DrvPvt *pvt = npvt;
-	unsigned long flags;
-	int pkts_left;
+	DrvPvt *pvt = nic;
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	pkts_left = (pvt->tx_drv - pvt->tx_nic + NUM_TX_DESC) % NUM_TX_DESC;
-	while (pkts_left--)
+	*usecs = READ_ONCE(pvt->coalesce_usecs);
+	*frames = READ_ONCE(pvt->coalesce_frames);
+}
+int nic_hw_set_coalesce(Nic *nic, unsigned int usecs, unsigned int frames) // Takes effect from the next pkt
+{
+	DrvPvt *pvt = nic;
+
+	if ((usecs > MAX_COALESCE_USECS) || (frames > NIC_MAX_DESC))
 	{
-		dev_kfree_skb(pvt->tx_ring_buffer[pvt->tx_nic]);
-		pvt->tx_ring_buffer[pvt->tx_nic] = NULL;
-		pvt->tx_nic = (pvt->tx_nic + 1) % NUM_TX_DESC;
+		return -EINVAL;
 	}
-	pvt->tx_drv = pvt->tx_nic = 0;
-	pkts_left = (pvt->rx_nic - pvt->rx_drv + NUM_RX_DESC) % NUM_RX_DESC;
-	while (pkts_left--)
+	if ((!usecs) && (frames > 1)) // W/o the timer, the pkts short of frames would never be interrupted for
 	{
-		dev_kfree_skb(pvt->rx_ring_buffer[pvt->rx_drv]);
-		pvt->rx_ring_buffer[pvt->rx_drv] = NULL;
-		pvt->rx_drv = (pvt->rx_drv + 1) % NUM_RX_DESC;
+		return -EINVAL;
 	}
-	pvt->rx_drv = pvt->rx_nic = 0;
-	spin_unlock_irqrestore(&pvt->lock, flags);
+	WRITE_ONCE(pvt->coalesce_usecs, usecs);
+	WRITE_ONCE(pvt->coalesce_frames, frames);
+	return 0;
 }
-void nic_register_handler(Handler handler, void *handler_param)
+
+void nic_hw_get_ring_size(Nic *nic, unsigned int *tx, unsigned int *rx)
 {
-	DrvPvt *pvt = npvt;
-	unsigned long flags;
+	DrvPvt *pvt = nic;
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	pvt->handler_param = handler_param;
-	pvt->handler = handler;
-	spin_unlock_irqrestore(&pvt->lock, flags);
+	*tx = pvt->tx_ring_size;
+	*rx = pvt->rx_ring_size;
 }
-void nic_unregister_handler(void)
+int nic_hw_set_ring_size(Nic *nic, unsigned int tx, unsigned int rx) // Rounded up to powers of 2
 {
-	DrvPvt *pvt = npvt;
-	unsigned long flags;
+	DrvPvt *pvt = nic;
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	pvt->handler = NULL;
-	pvt->handler_param = NULL;
-	spin_unlock_irqrestore(&pvt->lock, flags);
+	if ((tx < NIC_MIN_DESC) || (tx > NIC_MAX_DESC) || (rx < NIC_MIN_DESC) || (rx > NIC_MAX_DESC))
+	{
+		return -EINVAL;
+	}
+	pvt->tx_ring_size = roundup_pow_of_two(tx);
+	pvt->rx_ring_size = roundup_pow_of_two(rx);
+	return 0;
+}
+
+void nic_hw_set_rx_tstamp(Nic *nic, int on) // Takes effect from the next pkt
+{
+	WRITE_ONCE(nic->rx_tstamp, on);
 }
 
-void nic_hw_enable_intr(void)
+/*
+ * Post the pkt, i.e. its n descriptors w/ NIC_DESC_EOP on the last, into the tx ring.
+ * It gets picked up by the NIC only on ringing the doorbell.
+ * Fails only if not ready, or if the ring is full, which is avoided by stopping on nic_hw_tx_room()
+ */
+int nic_hw_tx_post(Nic *nic, unsigned int qid, const NicDesc *desc, unsigned int n)
 {
-	DrvPvt *pvt = npvt;
-	//unsigned long flags;
+	DrvPvt *pvt = nic;
+	NicQueue *q = &pvt->queues[qid];
 
-	pvt->nic_intr_enabled = 1;
-#ifdef TODO
-	// VNIC Hack: Check for pending interrupt by checking pkts in rx buffer & call handler, if pending
-	spin_lock_irqsave(&pvt->lock, flags);
-	if ((pvt->rx_drv != pvt->rx_nic) && (pvt->handler))
+	if (!smp_load_acquire(&pvt->nic_ready) || (ring_post(&q->tx_ring, desc, n, nic_lat_tstamp()) != 0)) // Not ready or Full
 	{
-		(*(pvt->handler))(pvt->handler_param);
+		return -1;
 	}
-	spin_unlock_irqrestore(&pvt->lock, flags);
-#endif
+	q->tx_pkts++;
+	if (nic_occ_sample(&q->tx_occ)) // Posted, yet to be reaped by the driver, including this one
+	{
+		nic_occ_add(&q->tx_occ, &q->tx_ring, q->tx_ring.mask + 1 - ring_room(&q->tx_ring));
+	}
+
+	return 0;
 }
-void nic_hw_disable_intr(void)
+void nic_hw_tx_kick(Nic *nic, unsigned int qid) // Ring the doorbell for the NIC to pick up the pkts posted so far
 {
-	DrvPvt *pvt = npvt;
+	NicQueue *q = &nic->queues[qid];
 
-	pvt->nic_intr_enabled = 0;
+	q->tx_doorbells++;
+	if (trace_vnic_doorbell_enabled())
+	{
+		trace_vnic_doorbell(nic->ndev, qid, false, ring_pending(&q->tx_ring));
+	}
+	napi_schedule(&q->napi); // VNIC Hack: Trigger the rx poll for the other end of the NIC
 }
-void nic_hw_init(void)
+unsigned int nic_hw_tx_room(Nic *nic, unsigned int qid) // Number of descriptors that can be posted into the tx ring
 {
-	DrvPvt *pvt = npvt;
+	NicQueue *q = &nic->queues[qid];
 
-	pvt->nic_ready = 1;
-	nic_hw_enable_intr();
+	return ring_room(&q->tx_ring);
 }
-void nic_hw_shut(void)
+int nic_hw_tx_reap(Nic *nic, unsigned int qid, NicDesc *desc) // Fails if no more transmitted
 {
-	DrvPvt *pvt = npvt;
+	NicQueue *q = &nic->queues[qid];
 
-	nic_hw_disable_intr();
-	pvt->nic_ready = 0;
+	return ring_reap(&q->tx_ring, desc);
 }
 
-int nic_hw_tx_pkt(struct sk_buff *skb)
+/*
+ * Post an empty rx buffer into the rx ring, for the NIC to receive a pkt into.
+ * May be done even before the NIC is ready, to have it filled up to start with.
+ * Fails only if the ring is full, which is avoided by posting only up to nic_hw_rx_room()
+ */
+int nic_hw_rx_post(Nic *nic, unsigned int qid, const NicDesc *desc)
 {
-	DrvPvt *pvt = npvt;
-	unsigned long flags;
-	int ret = -1;
+	NicQueue *q = &nic->queues[qid];
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	if ((pvt->nic_ready) &&
-		((pvt->tx_nic - (pvt->tx_drv + 1) + NUM_TX_DESC) % NUM_TX_DESC != 0)) // Not Full
+	return ring_post(&q->rx_ring, desc, 1, 0);
+}
+void nic_hw_rx_kick(Nic *nic, unsigned int qid) // Complete the reaped pkts to the NIC end xmit queue & wake it up
+{
+	NicQueue *q = &nic->queues[qid];
+	struct netdev_queue *txq = netdev_get_tx_queue(q->pvt->ndev, q->qid);
+
+	if (trace_vnic_doorbell_enabled())
 	{
-		pvt->tx_ring_buffer[0 /* TODO 1: index of the tx ring buffer to put the pkt for transmit */] = skb;
-		pvt->tx_drv = (pvt->tx_drv + 1) % NUM_TX_DESC;
-		ret = 0;
+		trace_vnic_doorbell(nic->ndev, qid, true, ring_pending(&q->rx_ring));
 	}
-	spin_unlock_irqrestore(&pvt->lock, flags);
-
-	if (ret == 0)
+	if (q->rx_done_pkts)
+	{
+		trace_vnic_tx_done(nic->ndev, qid, q->rx_done_pkts, q->rx_done_bytes);
+		netdev_tx_completed_queue(txq, q->rx_done_pkts, q->rx_done_bytes);
+		q->rx_done_pkts = q->rx_done_bytes = 0;
+	}
+	smp_mb(); // Order the descriptors posted w/ the stopped check below, against the reverse order in xmit
+	if ((netif_tx_queue_stopped(txq)) && (ring_pending(&q->rx_ring) >= RX_WAKE_THRESH(&q->rx_ring)))
 	{
-		napi_schedule(&pvt->napi); // VNIC Hack: Trigger the rx poll for the other end of the NIC
+		netif_tx_wake_queue(txq);
 	}
+}
+unsigned int nic_hw_rx_room(Nic *nic, unsigned int qid) // Number of descriptors that can be posted into the rx ring
+{
+	NicQueue *q = &nic->queues[qid];
 
-	return ret;
+	return ring_room(&q->rx_ring);
 }
-struct sk_buff *nic_hw_rx_pkt(void)
+int nic_hw_rx_reap(Nic *nic, unsigned int qid, NicDesc *desc) // Fails if no more received
 {
-	DrvPvt *pvt = npvt;
-	unsigned long flags;
-	struct sk_buff *skb = NULL;
+	NicQueue *q = &nic->queues[qid];
 
-	spin_lock_irqsave(&pvt->lock, flags);
-	if (pvt->rx_drv != pvt->rx_nic) // Not Empty
+	if (ring_reap(&q->rx_ring, desc) != 0)
+	{
+		return -1;
+	}
+	q->rx_done_pkts++;
+	q->rx_done_bytes += desc->len;
+	if (static_branch_unlikely(&lat_on))
 	{
-		skb = pvt->rx_ring_buffer[pvt->rx_drv];
-		pvt->rx_ring_buffer[0 /* TODO 2: index of the rx ring buffer to get the pkt for receive */] = NULL;
-		pvt->rx_drv = (pvt->rx_drv + 1) % NUM_RX_DESC;
+		nic_lat_add(&q->rx_lat, desc->tstamp);
 	}
-	spin_unlock_irqrestore(&pvt->lock, flags);
 
-	return skb;
+	return 0;
+}
+
+int nic_hw_tx_reclaim(Nic *nic, unsigned int qid, NicDesc *desc)
+{
+	NicQueue *q = &nic->queues[qid];
+
+	return ring_reclaim(&q->tx_ring, desc);
+}
+int nic_hw_rx_reclaim(Nic *nic, unsigned int qid, NicDesc *desc)
+{
+	NicQueue *q = &nic->queues[qid];
+
+	return ring_reclaim(&q->rx_ring, desc);
 }
 
+EXPORT_SYMBOL(nic_hw_num_nics);
+EXPORT_SYMBOL(nic_hw_get);
+EXPORT_SYMBOL(nic_hw_num_queues);
+EXPORT_SYMBOL(nic_hw_desc_mode);
 EXPORT_SYMBOL(nic_setup_buffers);
 EXPORT_SYMBOL(nic_cleanup_buffers);
 EXPORT_SYMBOL(nic_register_handler);
@@ -462,8 +1455,27 @@ EXPORT_SYMBOL(nic_hw_enable_intr);
 EXPORT_SYMBOL(nic_hw_disable_intr);
 EXPORT_SYMBOL(nic_hw_init);
 EXPORT_SYMBOL(nic_hw_shut);
-EXPORT_SYMBOL(nic_hw_tx_pkt);
-EXPORT_SYMBOL(nic_hw_rx_pkt);
+EXPORT_SYMBOL(nic_hw_get_coalesce);
+EXPORT_SYMBOL(nic_hw_set_coalesce);
+EXPORT_SYMBOL(nic_hw_get_ring_size);
+EXPORT_SYMBOL(nic_hw_set_ring_size);
+EXPORT_SYMBOL(nic_hw_set_rx_tstamp);
+EXPORT_SYMBOL(nic_hw_tx_post);
+EXPORT_SYMBOL(nic_hw_tx_kick);
+EXPORT_SYMBOL(nic_hw_tx_room);
+EXPORT_SYMBOL(nic_hw_tx_reap);
+EXPORT_SYMBOL(nic_hw_rx_post);
+EXPORT_SYMBOL(nic_hw_rx_kick);
+EXPORT_SYMBOL(nic_hw_rx_room);
+EXPORT_SYMBOL(nic_hw_rx_reap);
+EXPORT_SYMBOL(nic_hw_tx_reclaim);
+EXPORT_SYMBOL(nic_hw_rx_reclaim);
+EXPORT_TRACEPOINT_SYMBOL_GPL(vnic_xmit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(vnic_ring_full);
+EXPORT_TRACEPOINT_SYMBOL_GPL(vnic_poll_start);
+EXPORT_TRACEPOINT_SYMBOL_GPL(vnic_poll_end);
+EXPORT_TRACEPOINT_SYMBOL_GPL(vnic_rx);
+EXPORT_TRACEPOINT_SYMBOL_GPL(vnic_tx_done);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Anil Kumar Pugalia <anil@sysplay.in>");
@@ -4,19 +4,81 @@
 #ifdef __KERNEL__
 
 #include <linux/skbuff.h>
+#include <linux/virtio_net.h> // struct virtio_net_hdr, virtio_net_hdr_from_skb, virtio_net_hdr_to_skb
+
+/*
+ * Tx/Rx descriptor, as in a NIC ring
+ *
+ * In the (default) skb mode, the pkt itself is handed over through the skb, as a VNIC Hack.
+ * In the descriptor mode (nic desc_mode=1), the NIC copies the pkt from / into the buffer.
+ * Rx descriptors are posted by the driver w/ an empty buffer (of size len in descriptor mode),
+ * & are filled in by the NIC. Tx descriptors are posted w/ the pkt, one per buffer in descriptor mode,
+ * w/ the first having the offloads, & the last marked NIC_DESC_EOP & having the cookie.
+ * Either way, the NIC sets NIC_DESC_DONE on being through, handing over the descriptor back to the driver.
+ * In the descriptor mode, hdr describes the offloads (checksum, ...) of the pkt, as in virtio-net,
+ * w/ the fields in little endian & the offsets from its Ethernet header
+ */
+typedef struct _NicDesc
+{
+	void *addr; // Buffer (VNIC Hack: Its virtual address, in absence of DMA) - descriptor mode only
+	struct sk_buff *skb; // VNIC Hack: Pkt itself, instead of the buffer - skb mode only
+	void *cookie; // Driver's context for the buffer. Returned back as is
+	unsigned int len; // Length of the pkt, except for a posted rx descriptor, where it is the buffer size
+	unsigned int flags; // NIC_DESC_*
+	struct virtio_net_hdr hdr; // Offloads - descriptor mode only
+	/*
+	 * Set by the NIC, in ns of ktime_get_ns(): On transmitting a tx pkt marked NIC_DESC_TSTAMP, into its last one,
+	 * & on receiving into a rx one w/ the rx timestamping on. Else, on posting & receiving w/ the latency stats on
+	 */
+	u64 tstamp;
+} NicDesc;
+
+#define NIC_DESC_DONE 0x1 // Set by the NIC on transmitting from / receiving into it
+#define NIC_DESC_EOP 0x2 // Set by the driver on the last tx descriptor of a pkt
+#define NIC_DESC_TSTAMP 0x4 // Set by the driver on the last tx descriptor of a pkt, to get it timestamped
+
+#define NIC_MIN_DESC 64 // Min number of descriptors in a ring
+#define NIC_MAX_DESC 16384 // Max number of descriptors in a ring
 
 typedef void (*Handler)(void *);
 
-void nic_setup_buffers(void);
-void nic_cleanup_buffers(void);
-void nic_register_handler(Handler handler, void *handler_param);
-void nic_unregister_handler(void);
-void nic_hw_enable_intr(void);
-void nic_hw_disable_intr(void);
-void nic_hw_init(void); // Should be called after everything is set up
-void nic_hw_shut(void); // Should be called before anything is cleaned up
-int nic_hw_tx_pkt(struct sk_buff *skb);
-struct sk_buff *nic_hw_rx_pkt(void);
+typedef struct _Nic Nic; // A NIC instance, opaque to the driver
+
+/* One interface of the driver per NIC, paired w/ it. index is from 0 to nic_hw_num_nics() - 1 */
+unsigned int nic_hw_num_nics(void);
+Nic *nic_hw_get(unsigned int index);
+/* qid is the index of the tx/rx queue pair, from 0 to nic_hw_num_queues() - 1 */
+unsigned int nic_hw_num_queues(Nic *nic);
+int nic_hw_desc_mode(Nic *nic); // Non-zero => Descriptor mode. Zero => skb mode
+int nic_setup_buffers(Nic *nic);
+void nic_cleanup_buffers(Nic *nic);
+void nic_register_handler(Nic *nic, unsigned int qid, Handler handler, void *handler_param);
+void nic_unregister_handler(Nic *nic, unsigned int qid);
+void nic_hw_enable_intr(Nic *nic, unsigned int qid); // Interrupt gets masked on being fired, i.e. calls handler once
+void nic_hw_disable_intr(Nic *nic, unsigned int qid);
+void nic_hw_init(Nic *nic); // Should be called after everything is set up
+void nic_hw_shut(Nic *nic); // Should be called before anything is cleaned up
+/*
+ * Rx interrupt coalescing: Interrupt after usecs from the first pkt or after frames pkts (0 => unused).
+ * W/ usecs 0, interrupt per pkt, & so frames should be 0 or 1
+ */
+void nic_hw_get_coalesce(Nic *nic, unsigned int *usecs, unsigned int *frames);
+int nic_hw_set_coalesce(Nic *nic, unsigned int usecs, unsigned int frames);
+/* Ring sizes (rounded up to powers of 2), taking effect from the next nic_setup_buffers() */
+void nic_hw_get_ring_size(Nic *nic, unsigned int *tx, unsigned int *rx);
+int nic_hw_set_ring_size(Nic *nic, unsigned int tx, unsigned int rx);
+void nic_hw_set_rx_tstamp(Nic *nic, int on); // Timestamp every rx pkt, or not. Tx ones are on NIC_DESC_TSTAMP
+int nic_hw_tx_post(Nic *nic, unsigned int qid, const NicDesc *desc, unsigned int n); // n descriptors of a pkt
+void nic_hw_tx_kick(Nic *nic, unsigned int qid); // Doorbell for the descriptors posted so far
+unsigned int nic_hw_tx_room(Nic *nic, unsigned int qid);
+int nic_hw_tx_reap(Nic *nic, unsigned int qid, NicDesc *desc); // Next transmitted descriptor, to be cleaned up
+int nic_hw_rx_post(Nic *nic, unsigned int qid, const NicDesc *desc);
+void nic_hw_rx_kick(Nic *nic, unsigned int qid); // Doorbell for the descriptors posted & reaped so far
+unsigned int nic_hw_rx_room(Nic *nic, unsigned int qid);
+int nic_hw_rx_reap(Nic *nic, unsigned int qid, NicDesc *desc); // Next received descriptor
+/* To be called only after nic_hw_shut(), to get back all the posted but not reaped descriptors, done or not */
+int nic_hw_tx_reclaim(Nic *nic, unsigned int qid, NicDesc *desc);
+int nic_hw_rx_reclaim(Nic *nic, unsigned int qid, NicDesc *desc);
 
 #endif
 
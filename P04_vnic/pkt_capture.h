@@ -0,0 +1,282 @@
+#ifndef PKT_CAPTURE_H
+#define PKT_CAPTURE_H
+
+#include <linux/types.h>
+
+/*
+ * Header capture record, as written by the driver into its per CPU relay buffers, & read by the user (Apps/pcap_dump).
+ * Fixed size, so that the sub-buffers are exactly filled w/ the records, i.e. w/o any padding.
+ * Addresses are in the network byte order, as in the pkt. Rest of the fields are in the host byte order
+ */
+#define CAPTURE_SNAPLEN 96 // Max bytes captured of a pkt, from its Ethernet header. Enough for Eth + IP + TCP w/ options
+#define CAPTURE_DIR_RX 0
+#define CAPTURE_DIR_TX 1
+
+typedef struct _CaptureRec
+{
+	__u64 tstamp; // ns since the epoch
+	__u32 len; // Of the pkt
+	__u16 caplen; // Of data, i.e. min(len, CAPTURE_SNAPLEN)
+	__u8 dir; // CAPTURE_DIR_*
+	__u8 ip_proto; // IPPROTO_*, if IPv4. Else, 0
+	__u16 qid;
+	__u16 eth_proto; // ETH_P_*, if at least the Ethernet header. Else, 0
+	__u16 sport, dport; // If UDP / TCP. Else, 0
+	__u32 saddr, daddr; // If IPv4. Else, 0
+	__u8 data[CAPTURE_SNAPLEN];
+} CaptureRec;
+
+#ifdef __KERNEL__
+
+#include <linux/relay.h> // relay_open, relay_write, ...
+#include <linux/debugfs.h> // debugfs_create_file, ...
+#include <linux/jump_label.h> // DEFINE_STATIC_KEY_FALSE, static_branch_unlikely, ...
+#include <linux/skbuff.h> // skb_copy_bits, ...
+#include <linux/if_ether.h> // struct ethhdr, Ethernet protocol definitions
+#include <linux/ip.h> // struct iphdr
+#include <linux/in.h> // IP protocol definitions
+#include <linux/udp.h> // struct udphdr, UDP definitions
+#include <linux/tcp.h> // struct tcphdr, TCP definitions
+#include <linux/timekeeping.h> // ktime_get_real_ns
+#include <linux/atomic.h> // atomic64_t, ...
+#include <linux/mutex.h> // struct mutex, ...
+#include <linux/netdevice.h> // synchronize_net
+
+/*
+ * Lossless (unless the user falls behind) capture of the pkt headers of an interface, into per CPU relay buffers,
+ * as the debugfs files capture0, capture1, ... (one per CPU) under its directory, to be read by the user.
+ * Started & stopped by writing 1 & 0 into its capture file, alongwith which the buffers are reset & flushed.
+ * Records not fitting into the buffers, as the user fell behind, are dropped & counted in its capture_dropped file.
+ * Sub-buffers are freed up for the next records only by read() (which may also stream w/ poll()), & not by
+ * mmap, as there is no control file to mark them consumed. So, an mmap reader would see the drops after a wrap.
+ * Also, a partially filled sub-buffer gets readable only on being flushed, i.e. on stopping.
+ * Off => Just a patched out branch in the fast paths
+ */
+#define CAPTURE_SUBBUF_SIZE (512 * sizeof(CaptureRec))
+#define CAPTURE_N_SUBBUFS 16
+
+typedef struct _Capture
+{
+	struct dentry *dir; // Of the interface
+	struct rchan *chan; // Opened on the first start, & closed only on the capture_exit()
+	int on;
+	atomic64_t dropped;
+	struct mutex lock; // Serializes the start & stop
+} Capture;
+
+static DEFINE_STATIC_KEY_FALSE(capture_key); // On, if any interface is capturing
+
+static void capture_parse(CaptureRec *rec) // Same walk as in display_packet(), but over the captured bytes
+{
+	const __u8 *pkt = rec->data;
+	int len = rec->caplen;
+	unsigned int parsed_hdr_size = 0;
+	const struct ethhdr *eh;
+	const struct iphdr *ih;
+	const struct udphdr *uh;
+	const struct tcphdr *th;
+
+	eh = (const struct ethhdr *)(pkt + parsed_hdr_size);
+	if (len < (parsed_hdr_size + sizeof(struct ethhdr)))
+	{
+		return;
+	}
+	rec->eth_proto = ntohs(eh->h_proto);
+	if (rec->eth_proto != ETH_P_IP)
+	{
+		return;
+	}
+	parsed_hdr_size += sizeof(struct ethhdr);
+	ih = (const struct iphdr *)(pkt + parsed_hdr_size);
+	if (len < (parsed_hdr_size + sizeof(struct iphdr)))
+	{
+		return;
+	}
+	rec->ip_proto = ih->protocol;
+	rec->saddr = ih->saddr;
+	rec->daddr = ih->daddr;
+	parsed_hdr_size += ih->ihl * 4; // W/ the options, if any
+	if (ih->protocol == IPPROTO_UDP)
+	{
+		uh = (const struct udphdr *)(pkt + parsed_hdr_size);
+		if (len < (parsed_hdr_size + sizeof(struct udphdr)))
+		{
+			return;
+		}
+		rec->sport = ntohs(uh->source);
+		rec->dport = ntohs(uh->dest);
+	}
+	else if (ih->protocol == IPPROTO_TCP)
+	{
+		th = (const struct tcphdr *)(pkt + parsed_hdr_size);
+		if (len < (parsed_hdr_size + sizeof(struct tcphdr)))
+		{
+			return;
+		}
+		rec->sport = ntohs(th->source);
+		rec->dport = ntohs(th->dest);
+	}
+}
+static void __capture_pkt(Capture *cap, struct sk_buff *skb, unsigned int qid, int dir)
+{
+	CaptureRec rec = {};
+	int off = skb_mac_header_was_set(skb) ? skb_mac_offset(skb) : 0; // On rx, it's behind skb->data
+
+	if (!READ_ONCE(cap->on))
+	{
+		return;
+	}
+	rec.tstamp = ktime_get_real_ns();
+	rec.len = skb->len - off;
+	rec.caplen = min_t(unsigned int, rec.len, CAPTURE_SNAPLEN);
+	rec.dir = dir;
+	rec.qid = qid;
+	if (skb_copy_bits(skb, off, rec.data, rec.caplen))
+	{
+		rec.caplen = 0;
+	}
+	capture_parse(&rec);
+	relay_write(cap->chan, &rec, sizeof(rec)); // Irq safe, as may be called from the xmit as well as the poll
+}
+static inline void capture_pkt(Capture *cap, struct sk_buff *skb, unsigned int qid, int dir)
+{
+	if (static_branch_unlikely(&capture_key))
+	{
+		__capture_pkt(cap, skb, qid, dir);
+	}
+}
+
+static int capture_subbuf_start(struct rchan_buf *buf, void *subbuf, void *prev_subbuf, size_t prev_padding)
+{
+	Capture *cap = buf->chan->private_data;
+
+	if (relay_buf_full(buf)) // User fell behind (or isn't reading). So, drop instead of overwriting the unread ones
+	{
+		atomic64_inc(&cap->dropped);
+		return 0;
+	}
+	return 1;
+}
+static struct dentry *capture_create_buf_file(const char *filename, struct dentry *parent, umode_t mode,
+						struct rchan_buf *buf, int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+static int capture_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+static const struct rchan_callbacks capture_callbacks =
+{
+	.subbuf_start = capture_subbuf_start,
+	.create_buf_file = capture_create_buf_file,
+	.remove_buf_file = capture_remove_buf_file,
+};
+
+static int capture_start(Capture *cap)
+{
+	int ret = 0;
+
+	mutex_lock(&cap->lock);
+	if (cap->on)
+	{
+		goto out;
+	}
+	if (!cap->chan)
+	{
+		cap->chan = relay_open("capture", cap->dir, CAPTURE_SUBBUF_SIZE, CAPTURE_N_SUBBUFS, &capture_callbacks, cap);
+		if (!cap->chan)
+		{
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+	else
+	{
+		relay_reset(cap->chan); // Stopped, & hence no writers
+	}
+	atomic64_set(&cap->dropped, 0);
+	WRITE_ONCE(cap->on, 1);
+	static_branch_inc(&capture_key);
+out:
+	mutex_unlock(&cap->lock);
+	return ret;
+}
+static void capture_stop(Capture *cap)
+{
+	mutex_lock(&cap->lock);
+	if (cap->on)
+	{
+		static_branch_dec(&capture_key);
+		WRITE_ONCE(cap->on, 0);
+		synchronize_net(); // For the ongoing writers, if any, to be through
+		relay_flush(cap->chan); // For the user to get the partially filled sub-buffers as well
+	}
+	mutex_unlock(&cap->lock);
+}
+
+static ssize_t capture_on_read(struct file *file, char __user *buf, size_t len, loff_t *off)
+{
+	Capture *cap = file->private_data;
+	char c[2] = { READ_ONCE(cap->on) ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(buf, len, off, c, sizeof(c));
+}
+static ssize_t capture_on_write(struct file *file, const char __user *buf, size_t len, loff_t *off)
+{
+	Capture *cap = file->private_data;
+	bool on;
+	int ret;
+
+	if ((ret = kstrtobool_from_user(buf, len, &on)))
+	{
+		return ret;
+	}
+	if (on)
+	{
+		ret = capture_start(cap);
+	}
+	else
+	{
+		capture_stop(cap);
+	}
+	return ret ? ret : len;
+}
+static const struct file_operations capture_on_fops =
+{
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = capture_on_read,
+	.write = capture_on_write,
+	.llseek = default_llseek,
+};
+static int capture_dropped_get(void *data, u64 *val)
+{
+	*val = atomic64_read(&((Capture *)(data))->dropped);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(capture_dropped_fops, capture_dropped_get, NULL, "%llu\n");
+
+static void capture_init(Capture *cap, struct dentry *dir) // dir is of the interface
+{
+	cap->dir = dir;
+	cap->chan = NULL;
+	cap->on = 0;
+	atomic64_set(&cap->dropped, 0);
+	mutex_init(&cap->lock);
+	debugfs_create_file("capture", 0644, dir, cap, &capture_on_fops);
+	debugfs_create_file_unsafe("capture_dropped", 0444, dir, cap, &capture_dropped_fops);
+}
+static void capture_exit(Capture *cap) // After the interface is unregistered, & before its directory is removed
+{
+	capture_stop(cap);
+	if (cap->chan)
+	{
+		relay_close(cap->chan);
+	}
+}
+
+#endif
+
+#endif
@@ -0,0 +1 @@
+../P03_ndo/pkt_trace.h
\ No newline at end of file
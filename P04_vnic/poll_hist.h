@@ -0,0 +1,93 @@
+#ifndef POLL_HIST_H
+#define POLL_HIST_H
+
+#ifdef __KERNEL__
+
+#include <linux/bitops.h> // fls
+#include <linux/seq_file.h> // seq_printf, single_open, ...
+#include <linux/debugfs.h> // struct file_operations, ...
+#include <linux/math64.h> // div64_u64
+
+/*
+ * Histogram of the work done by the napi polls of a queue, in power of 2 buckets, along w/ the polls exhausting
+ * their budget. Mostly exhausting => Poll bound, i.e. the napi weight or the ring size may be too small.
+ * Mostly doing 0 or 1 => Interrupt bound, i.e. the interrupt coalescing may be too low.
+ * Updated only by the poll, & hence w/o any lock. Read & reset as is, being only debug stats
+ */
+#define POLL_HIST_BUCKETS 9 // [0, 1), [1, 2), [2, 4), ..., [64, 128), & then >= 128
+
+typedef struct _PollHist
+{
+	u64 buckets[POLL_HIST_BUCKETS];
+	u64 count;
+	u64 full; // Polls exhausting their budget
+	u64 work; // Done by all the polls
+} PollHist;
+
+static inline void poll_hist_add(PollHist *h, int work_done, int budget)
+{
+	if (!budget) // Netpoll's, for the tx completions only
+	{
+		return;
+	}
+	h->buckets[min_t(unsigned int, fls(work_done), POLL_HIST_BUCKETS - 1)]++;
+	h->count++;
+	h->full += (work_done >= budget);
+	h->work += work_done;
+}
+
+static int poll_hist_show(struct seq_file *s, void *v)
+{
+	PollHist h = *(PollHist *)(s->private); // Snapshot, as may be getting updated
+	u64 per_mille;
+	int b;
+
+	seq_printf(s, "polls: %llu\n", h.count);
+	if (!h.count)
+	{
+		return 0;
+	}
+	per_mille = div64_u64(h.full * 1000, h.count);
+	seq_printf(s, "budget exhausted: %llu (%llu.%llu%%)\n", h.full, per_mille / 10, per_mille % 10);
+	seq_printf(s, "avg work done: %llu\n", div64_u64(h.work, h.count));
+	for (b = 0; b < POLL_HIST_BUCKETS; b++)
+	{
+		if (!h.buckets[b])
+		{
+			continue;
+		}
+		if (b < POLL_HIST_BUCKETS - 1)
+		{
+			seq_printf(s, "[%u, %u): %llu\n", b ? 1U << (b - 1) : 0, 1U << b, h.buckets[b]);
+		}
+		else
+		{
+			seq_printf(s, ">= %u: %llu\n", 1U << (b - 1), h.buckets[b]);
+		}
+	}
+	return 0;
+}
+static int poll_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, poll_hist_show, inode->i_private);
+}
+static ssize_t poll_hist_write(struct file *file, const char __user *buf, size_t len, loff_t *off) // Reset
+{
+	PollHist *h = ((struct seq_file *)(file->private_data))->private;
+
+	memset(h, 0, sizeof(*h));
+	return len;
+}
+static const struct file_operations poll_hist_fops = // Of a PollHist, as its debugfs file data
+{
+	.owner = THIS_MODULE,
+	.open = poll_hist_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = poll_hist_write,
+	.release = single_release,
+};
+
+#endif
+
+#endif
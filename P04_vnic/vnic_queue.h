@@ -0,0 +1,77 @@
+#ifndef VNIC_QUEUE_H
+#define VNIC_QUEUE_H
+
+#ifdef __KERNEL__
+
+#include <linux/netdevice.h> // struct net_device, netif_set_xps_queue
+#include <linux/cpumask.h> // for_each_online_cpu, ...
+#include <linux/u64_stats_sync.h> // struct u64_stats_sync, ...
+
+/*
+ * Per queue helpers common to the NIC (nic.c) & its driver, each w/ its own tx/rx queue pairs
+ */
+
+/* Updated only by one side of a queue, & hence w/o any lock. Exact even on 32-bit, through syncp */
+typedef struct _QueueStats
+{
+	u64 packets;
+	u64 bytes;
+	u64 dropped;
+	struct u64_stats_sync syncp;
+} QueueStats;
+
+static inline void vnic_stats_add(QueueStats *stats, unsigned int pkts, unsigned int bytes, unsigned int dropped)
+{
+	u64_stats_update_begin(&stats->syncp);
+	stats->packets += pkts;
+	stats->bytes += bytes;
+	stats->dropped += dropped;
+	u64_stats_update_end(&stats->syncp);
+}
+static inline void vnic_stats_fetch(QueueStats *stats, u64 *pkts, u64 *bytes, u64 *dropped)
+{
+	unsigned int start;
+
+	do
+	{
+		start = u64_stats_fetch_begin(&stats->syncp);
+		*pkts = stats->packets;
+		*bytes = stats->bytes;
+		*dropped = stats->dropped;
+	} while (u64_stats_fetch_retry(&stats->syncp, start));
+}
+static inline void vnic_stats_clear(QueueStats *stats)
+{
+	u64_stats_update_begin(&stats->syncp);
+	stats->packets = stats->bytes = stats->dropped = 0;
+	u64_stats_update_end(&stats->syncp);
+}
+
+static inline void vnic_set_xps(struct net_device *dev, unsigned int num_queues)
+{
+	cpumask_var_t mask;
+	unsigned int i, cpu, n;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+	{
+		return; // Not fatal. Just that the queue would be picked by the flow hash
+	}
+	for (i = 0; i < num_queues; i++) // Spread the online CPUs across the queues
+	{
+		cpumask_clear(mask);
+		n = 0;
+		for_each_online_cpu(cpu)
+		{
+			if (n++ % num_queues == i)
+			{
+				cpumask_set_cpu(cpu, mask);
+			}
+		}
+		netif_set_xps_queue(dev, mask, i);
+	}
+	free_cpumask_var(mask);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vnic
+
+#if !defined(VNIC_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define VNIC_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/netdevice.h> // struct net_device
+
+/*
+ * Tracepoints of the xmit, ring & napi paths, of the NIC & of its driver, each w/ its interface & queue.
+ * Defined in the NIC (nic.c), & used by the driver as well. No cost, other than a patched out branch, unless enabled,
+ * e.g. through /sys/kernel/tracing/events/vnic/, perf -e 'vnic:*' or bpftrace -e 'tracepoint:vnic:* ...'.
+ * tstamp is the NIC's descriptor timestamp (ktime_get_ns()), if stamped (else 0), as per NicDesc in nic.h.
+ * So, comparable w/ the event time, under the mono trace clock.
+ */
+
+TRACE_EVENT(vnic_xmit, // Pkt enqueued into a ring, w/ the descriptors left thereafter
+	TP_PROTO(const struct net_device *dev, unsigned int qid, unsigned int len, unsigned int ndesc, unsigned int room),
+	TP_ARGS(dev, qid, len, ndesc, room),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(unsigned int, len)
+		__field(unsigned int, ndesc)
+		__field(unsigned int, room)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->len = len;
+		__entry->ndesc = ndesc;
+		__entry->room = room;
+	),
+	TP_printk("dev=%s qid=%u len=%u ndesc=%u room=%u",
+		__get_str(name), __entry->qid, __entry->len, __entry->ndesc, __entry->room)
+);
+
+TRACE_EVENT(vnic_ring_full, // Xmit queue stopped, for lack of descriptors for the next pkt
+	TP_PROTO(const struct net_device *dev, unsigned int qid, unsigned int room),
+	TP_ARGS(dev, qid, room),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(unsigned int, room)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->room = room;
+	),
+	TP_printk("dev=%s qid=%u room=%u", __get_str(name), __entry->qid, __entry->room)
+);
+
+TRACE_EVENT(vnic_doorbell, // Driver kicking the NIC, w/ the descriptors pending (tx) or posted (rx) in the ring
+	TP_PROTO(const struct net_device *dev, unsigned int qid, bool rx, unsigned int pending),
+	TP_ARGS(dev, qid, rx, pending),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(bool, rx)
+		__field(unsigned int, pending)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->rx = rx;
+		__entry->pending = pending;
+	),
+	TP_printk("dev=%s qid=%u ring=%s pending=%u",
+		__get_str(name), __entry->qid, __entry->rx ? "rx" : "tx", __entry->pending)
+);
+
+TRACE_EVENT(vnic_intr, // Interrupt raised to the driver, w/ the pkts received since the last one
+	TP_PROTO(const struct net_device *dev, unsigned int qid, unsigned int pkts),
+	TP_ARGS(dev, qid, pkts),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(unsigned int, pkts)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->pkts = pkts;
+	),
+	TP_printk("dev=%s qid=%u pkts=%u", __get_str(name), __entry->qid, __entry->pkts)
+);
+
+TRACE_EVENT(vnic_poll_start,
+	TP_PROTO(const struct net_device *dev, unsigned int qid, int budget),
+	TP_ARGS(dev, qid, budget),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(int, budget)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->budget = budget;
+	),
+	TP_printk("dev=%s qid=%u budget=%d", __get_str(name), __entry->qid, __entry->budget)
+);
+
+TRACE_EVENT(vnic_poll_end, // work_done == budget => To be polled again
+	TP_PROTO(const struct net_device *dev, unsigned int qid, int work_done, int budget),
+	TP_ARGS(dev, qid, work_done, budget),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(int, work_done)
+		__field(int, budget)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->work_done = work_done;
+		__entry->budget = budget;
+	),
+	TP_printk("dev=%s qid=%u work_done=%d budget=%d",
+		__get_str(name), __entry->qid, __entry->work_done, __entry->budget)
+);
+
+TRACE_EVENT(vnic_rx, // Pkt delivered to the stack
+	TP_PROTO(const struct net_device *dev, unsigned int qid, unsigned int len, u64 tstamp),
+	TP_ARGS(dev, qid, len, tstamp),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(unsigned int, len)
+		__field(u64, tstamp)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->len = len;
+		__entry->tstamp = tstamp;
+	),
+	TP_printk("dev=%s qid=%u len=%u tstamp=%llu", __get_str(name), __entry->qid, __entry->len, __entry->tstamp)
+);
+
+TRACE_EVENT(vnic_tx_done, // Pkts completed to the xmit queue, in one go
+	TP_PROTO(const struct net_device *dev, unsigned int qid, unsigned int pkts, unsigned int bytes),
+	TP_ARGS(dev, qid, pkts, bytes),
+	TP_STRUCT__entry(
+		__string(name, dev->name)
+		__field(unsigned int, qid)
+		__field(unsigned int, pkts)
+		__field(unsigned int, bytes)
+	),
+	TP_fast_assign(
+		__assign_str(name, dev->name);
+		__entry->qid = qid;
+		__entry->pkts = pkts;
+		__entry->bytes = bytes;
+	),
+	TP_printk("dev=%s qid=%u pkts=%u bytes=%u", __get_str(name), __entry->qid, __entry->pkts, __entry->bytes)
+);
+
+#endif
+
+/* Outside the multi-read protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE vnic_trace
+#include <trace/define_trace.h>
@@ -9,21 +9,129 @@
 #include <linux/udp.h> // struct udphdr, UDP definitions
 #include <linux/tcp.h> // struct tcphdr, TCP definitions
 #include <linux/byteorder/generic.h> // ntoh...
+#include <linux/cpumask.h> // for_each_online_cpu, ...
+#include <linux/u64_stats_sync.h> // struct u64_stats_sync, ...
+#include <linux/ethtool.h> // struct ethtool_ops, ...
+#include <linux/math64.h> // div64_u64
+#include <net/page_pool.h> // page_pool_create, page_pool_dev_alloc_pages, ...
+#include <linux/bpf.h> // struct bpf_prog, struct netdev_bpf, ...
+#include <linux/filter.h> // bpf_prog_run_xdp, xdp_do_redirect, ...
+#include <linux/bpf_trace.h> // trace_xdp_exception
+#include <net/xdp.h> // struct xdp_buff, struct xdp_frame, struct xdp_rxq_info, ...
+#include <net/xdp_sock_drv.h> // struct xsk_buff_pool, xsk_buff_alloc, xsk_tx_peek_desc, ...
+#include <linux/slab.h> // kcalloc, kfree
+#include <linux/net_tstamp.h> // struct hwtstamp_config, HWTSTAMP_*
+#include <linux/uaccess.h> // copy_from_user, copy_to_user
+#include <linux/debugfs.h> // debugfs_create_dir, ...
+#include <linux/rtnetlink.h> // rtnl_lock, rtnl_unlock
 
 #define DRV_PREFIX "end"
 #include "common.h"
+#include "pkt_trace.h"
+#include "vnic_queue.h"
+#include "pkt_capture.h"
+#include "poll_hist.h"
 
 #include "nic.h"
+#include "vnic_trace.h"
 
 #define END_NAPI_WEIGHT 64
+#define END_TX_MAX_DESC (MAX_SKB_FRAGS + 1) /* Max descriptors of a tx pkt: Its head & frags */
+#define END_TX_STOP_THRESH END_TX_MAX_DESC /* Min room in tx ring for the next pkt, below which the queue is stopped */
+#define END_TX_WAKE_THRESH 32 /* Room in tx ring to wake up the stopped queue */
+/* Rx buffer is a page, w/ the headroom for XDP (& so, for the stack) & the tailroom for the skb_shared_info */
+#define END_RX_HEADROOM (XDP_PACKET_HEADROOM + NET_IP_ALIGN)
+#define END_RX_BUF_SIZE (PAGE_SIZE - END_RX_HEADROOM - SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+#define END_XDP_ACTIONS (XDP_REDIRECT + 1) /* XDP_ABORTED, XDP_DROP, XDP_PASS, XDP_TX, XDP_REDIRECT */
+#define END_XDP_TX_BULK 16 /* XDP_TX frames posted together, under one tx queue lock & doorbell */
+#define END_TX_XDP 0x1UL /* Tag in the cookie of a tx descriptor, for an XDP frame instead of an skb */
+#define END_TX_XSK ((void *)(0x2UL)) /* Cookie of a tx descriptor, for a buffer of the AF_XDP socket's umem */
+/* Tx events of a queue */
+#define END_TX_RING_FULL 0 /* Queue stops, for lack of room in the tx ring */
+#define END_TX_DOORBELLS 1
+#define END_TX_EVENTS 2
+/* Interrupt events of a queue */
+#define END_INTR_INTERRUPTS 0
+#define END_INTR_EVENTS 1
+/* Napi events of a queue */
+#define END_NAPI_POLLS 0
+#define END_NAPI_FULL_POLLS 1 /* Polls exhausting the budget */
+#define END_NAPI_WORK 2 /* Rx pkts processed by the polls, for their average batch */
+#define END_NAPI_EVENTS 3
+#define END_MAX_EVENTS END_NAPI_EVENTS
 
-typedef struct _DrvPvt
+typedef struct _DrvPvt DrvPvt;
+
+/*
+ * Counters of the tx (END_TX_*), interrupt (END_INTR_*) or napi (END_NAPI_*) events of a queue.
+ * Updated only by one side, as QueueStats
+ */
+typedef struct _QueueEvents
 {
-	struct net_device *ndev;
+	u64 count[END_MAX_EVENTS];
+	struct u64_stats_sync syncp;
+} QueueEvents;
+
+/* Verdicts of the XDP program, & the failures to carry out the XDP_TX / XDP_REDIRECT ones. Updated by the poll only */
+typedef struct _XdpStats
+{
+	u64 actions[END_XDP_ACTIONS];
+	u64 errors;
+	struct u64_stats_sync syncp;
+} XdpStats;
+
+typedef struct _QueuePvt
+{
+	DrvPvt *pvt;
+	unsigned int qid;
 	struct napi_struct napi;
-} DrvPvt;
+	struct page_pool *page_pool; // Of the rx buffers, in the NIC's descriptor mode
+	struct xsk_buff_pool *xsk_pool; // Of the bound AF_XDP socket, if any, for the rx & tx buffers (zero-copy)
+	/*
+	 * Tx buffers of the socket failed to be posted (NIC not ready), & so to be completed only after the ones
+	 * already in the ring, as the completion ring is in the peek order. Counted by the poll, & completed on the
+	 * ring's reclaim, w/ the napi disabled
+	 */
+	unsigned int xsk_tx_dropped;
+	NicDesc tx_desc[END_TX_MAX_DESC]; // Of the pkt being transmitted. Used only under the tx queue lock
+	struct xdp_rxq_info xdp_rxq; // Rx queue info of the XDP buffers, w/ the page pool as their memory model
+	struct xdp_frame *xdp_tx[END_XDP_TX_BULK]; // XDP_TX frames of the poll, yet to be posted
+	unsigned int xdp_tx_cnt;
+	/* On separate cache lines, as updated by the xmit & the poll, which may run on different cores */
+	QueueStats tx_stats ____cacheline_aligned_in_smp;
+	QueueEvents tx_events; // Along w/ the tx ones, as updated under the tx queue lock only
+	QueueStats rx_stats ____cacheline_aligned_in_smp;
+	XdpStats xdp_stats; // Along w/ the rx ones, as updated by the poll only
+	QueueEvents napi_events; // By the poll only, incl. the busy polls, as serialized through the napi ownership
+	/*
+	 * By the interrupt handler only, as fired once till re-enabled. Separate, as may fire alongside a busy poll,
+	 * w/ the interrupt re-enabled by the earlier completion
+	 */
+	QueueEvents intr_events ____cacheline_aligned_in_smp;
+	PollHist poll_hist; // By the poll only
+} QueuePvt;
+
+struct _DrvPvt
+{
+	struct net_device *ndev;
+	Nic *nic; // Paired w/
+	int desc_mode; // NIC's descriptor mode, i.e. pkts are copied through the buffers, instead of skbs
+	struct bpf_prog __rcu *xdp_prog; // Run on every rx buffer, if attached. Only in the descriptor mode
+	struct hwtstamp_config tstamp_config; // Hw timestamping, as set through SIOCSHWTSTAMP
+	struct dentry *dbg_dir; // Debugfs directory of this interface
+	Capture capture; // Of the pkt headers, through the debugfs
+	int up; // Buffers set up & the NIC started, i.e. between end_up() & end_down(). Under RTNL
+	unsigned int num_queues;
+	QueuePvt queues[]; // One per tx/rx queue pair of the NIC
+};
+
+static bool threaded; // false => NAPI polls in the softirq
+module_param(threaded, bool, 0444);
+MODULE_PARM_DESC(threaded, "Poll in the per napi kthreads, instead of the softirq (also, /sys/class/net/<if>/threaded)");
 
-static DrvPvt *npvt;
+static DrvPvt **npvts; // One per NIC
+static unsigned int num_devs;
+static struct dentry *dbg_root; // Debugfs directory of all the interfaces
 
 static void display_packet(struct sk_buff *skb)
 {
@@ -111,150 +219,1511 @@ static void display_packet(struct sk_buff *skb)
 	}
 }
 
-static void handler(void *handler_param)
+static inline void end_xdp_stats_add(XdpStats *stats, const unsigned int *actions, unsigned int errors)
 {
-	DrvPvt *pvt = (DrvPvt *)(handler_param);
+	int i;
 
-	nic_hw_disable_intr();
-	napi_schedule(&pvt->napi);
+	u64_stats_update_begin(&stats->syncp);
+	for (i = 0; i < END_XDP_ACTIONS; i++)
+	{
+		stats->actions[i] += actions[i];
+	}
+	stats->errors += errors;
+	u64_stats_update_end(&stats->syncp);
 }
+static void end_xdp_stats_fetch(XdpStats *stats, u64 *actions, u64 *errors)
+{
+	unsigned int start;
+	int i;
 
-static int end_open(struct net_device *dev)
+	do
+	{
+		start = u64_stats_fetch_begin(&stats->syncp);
+		for (i = 0; i < END_XDP_ACTIONS; i++)
+		{
+			actions[i] = stats->actions[i];
+		}
+		*errors = stats->errors;
+	} while (u64_stats_fetch_retry(&stats->syncp, start));
+}
+static void end_xdp_stats_clear(XdpStats *stats)
 {
-	DrvPvt *pvt = netdev_priv(dev);
+	u64_stats_update_begin(&stats->syncp);
+	memset(stats->actions, 0, sizeof(stats->actions));
+	stats->errors = 0;
+	u64_stats_update_end(&stats->syncp);
+}
 
-	iprintk("open\n");
-	nic_setup_buffers();
-	napi_enable(&pvt->napi);
-	nic_register_handler(handler, pvt);
-	nic_hw_init();
-	return 0;
+static inline void end_events_add(QueueEvents *events, unsigned int event, unsigned int n)
+{
+	u64_stats_update_begin(&events->syncp);
+	events->count[event] += n;
+	u64_stats_update_end(&events->syncp);
 }
-static int end_close(struct net_device *dev)
+static void end_events_fetch(QueueEvents *events, u64 *count, unsigned int n)
 {
-	DrvPvt *pvt = netdev_priv(dev);
+	unsigned int start;
 
-	iprintk("close\n");
-	nic_hw_shut();
-	nic_unregister_handler();
-	napi_disable(&pvt->napi);
-	nic_cleanup_buffers(); // In turn, also clears the pkts, if any
-	// Clear the stats
-	memset(&dev->stats, 0, sizeof(dev->stats));
-	return 0;
+	do
+	{
+		start = u64_stats_fetch_begin(&events->syncp);
+		memcpy(count, events->count, n * sizeof(*count));
+	} while (u64_stats_fetch_retry(&events->syncp, start));
 }
-static int end_start_xmit(struct sk_buff *skb, struct net_device *dev)
+static void end_events_clear(QueueEvents *events)
 {
-	int len;
+	u64_stats_update_begin(&events->syncp);
+	memset(events->count, 0, sizeof(events->count));
+	u64_stats_update_end(&events->syncp);
+}
 
-	iprintk("tx\n");
-	display_packet(skb);
-	len = skb->len; // HACK: To avoid using skb after packet transmission
-	if (nic_hw_tx_pkt(skb)) // Buffer Full & hence dropped
+static void handler(void *handler_param)
+{
+	QueuePvt *qp = (QueuePvt *)(handler_param);
+
+	end_events_add(&qp->intr_events, END_INTR_INTERRUPTS, 1);
+	napi_schedule(&qp->napi); // Interrupt already masked by the NIC, on firing
+}
+
+static int end_rx_pool_create(QueuePvt *qp) // Or, register the AF_XDP socket's one, if bound
+{
+	struct page_pool_params pp_params =
 	{
-		dev->stats.tx_dropped++;
-		dev_kfree_skb(skb);
+		.order = 0,
+		.pool_size = nic_hw_rx_room(qp->pvt->nic, qp->qid), // Enough to recycle a full ring
+		.nid = NUMA_NO_NODE,
+		.dma_dir = DMA_FROM_DEVICE, // VNIC Hack: No DMA mapping (PP_FLAG_DMA_MAP), as there is no DMA
+	};
+	struct page_pool *pool;
+	int ret;
+
+	if (qp->xsk_pool) // Rx buffers straight from the umem, for the pkts to be redirected w/o a copy
+	{
+		if ((ret = xdp_rxq_info_reg(&qp->xdp_rxq, qp->pvt->ndev, qp->qid, qp->napi.napi_id)))
+		{
+			return ret;
+		}
+		if ((ret = xdp_rxq_info_reg_mem_model(&qp->xdp_rxq, MEM_TYPE_XSK_BUFF_POOL, NULL)))
+		{
+			xdp_rxq_info_unreg(&qp->xdp_rxq);
+			return ret;
+		}
+		xsk_pool_set_rxq_info(qp->xsk_pool, &qp->xdp_rxq);
+		return 0;
 	}
-	else
+	pool = page_pool_create(&pp_params);
+	if (IS_ERR(pool))
+	{
+		return PTR_ERR(pool);
+	}
+	// Also, the memory model of the XDP buffers, for the XDP frames to go back to the pool
+	if ((ret = xdp_rxq_info_reg(&qp->xdp_rxq, qp->pvt->ndev, qp->qid, qp->napi.napi_id)))
 	{
-		dev->stats.tx_packets++;
-		dev->stats.tx_bytes += len;
+		page_pool_destroy(pool);
+		return ret;
 	}
+	if ((ret = xdp_rxq_info_reg_mem_model(&qp->xdp_rxq, MEM_TYPE_PAGE_POOL, pool)))
+	{
+		xdp_rxq_info_unreg(&qp->xdp_rxq);
+		page_pool_destroy(pool);
+		return ret;
+	}
+	qp->page_pool = pool;
 	return 0;
 }
-static int end_set_mac_address(struct net_device *dev, void *addr)
+static void end_rx_refill(QueuePvt *qp) // Post empty rx buffers for all the room in the rx ring
 {
-	iprintk("set_mac\n");
-	return eth_mac_addr(dev, addr);
+	NicDesc desc = {};
+	struct xdp_buff *xdp;
+	struct page *page;
+	unsigned int room;
+
+	for (room = nic_hw_rx_room(qp->pvt->nic, qp->qid); room; room--)
+	{
+		if (qp->xsk_pool)
+		{
+			if (!(xdp = xsk_buff_alloc(qp->xsk_pool)))
+			{
+				break; // Fill ring empty. Would be retried on the next poll, or on the wakeup
+			}
+			desc.addr = xdp->data; // VNIC Hack: No DMA address
+			desc.len = xsk_pool_get_rx_frame_size(qp->xsk_pool);
+			desc.cookie = xdp;
+		}
+		else if (qp->pvt->desc_mode)
+		{
+			if (!(page = page_pool_dev_alloc_pages(qp->page_pool)))
+			{
+				break; // Would be retried on the next poll
+			}
+			desc.addr = page_address(page) + END_RX_HEADROOM; // VNIC Hack: No DMA address
+			desc.len = END_RX_BUF_SIZE;
+			desc.cookie = page;
+		}
+		// else VNIC Hack: No buffer, as the NIC hands over the skb itself
+		nic_hw_rx_post(qp->pvt->nic, qp->qid, &desc);
+	}
+	if ((qp->xsk_pool) && (xsk_uses_need_wakeup(qp->xsk_pool))) // Ask the user to wake up, on filling more
+	{
+		if (room)
+		{
+			xsk_set_rx_need_wakeup(qp->xsk_pool);
+		}
+		else
+		{
+			xsk_clear_rx_need_wakeup(qp->xsk_pool);
+		}
+	}
 }
+// Around the received rx buffer, w/ the pkt at headroom, as left by XDP, if any
+static struct sk_buff *end_rx_build_skb(QueuePvt *qp, struct page *page, unsigned int headroom, unsigned int len)
+{
+	struct sk_buff *skb;
 
-static const struct net_device_ops end_netdev_ops =
+	if (!(skb = napi_build_skb(page_address(page), PAGE_SIZE)))
+	{
+		page_pool_recycle_direct(qp->page_pool, page);
+		return NULL;
+	}
+	skb_reserve(skb, headroom);
+	__skb_put(skb, len);
+	skb_mark_for_recycle(skb); // Page goes back to the pool, on the skb getting freed
+	return skb;
+}
+/*
+ * Prepare the skb of the received pkt for the stack, including its checksum status:
+ * W/ NETIF_F_RXCSUM, a pkt w/ its checksum yet to be filled in (CHECKSUM_PARTIAL) is passed up as is, as veth does,
+ * as it never left the host, & the one validated before its transmission is passed up as CHECKSUM_UNNECESSARY.
+ * W/o it, the checksum is filled in, as a NIC's tx checksum offload would have, & left for the stack to validate
+ */
+static struct sk_buff *end_rx_skb(QueuePvt *qp, NicDesc *desc)
 {
-	.ndo_open = end_open,
-	.ndo_stop = end_close,
-	.ndo_start_xmit = end_start_xmit,
-	.ndo_set_mac_address = end_set_mac_address,
-};
+	struct net_device *dev = qp->pvt->ndev;
+	struct sk_buff *skb;
 
-static void end_get_drvinfo(struct net_device *dev, struct ethtool_drvinfo *info)
+	if (qp->pvt->desc_mode)
+	{
+		if (!(skb = end_rx_build_skb(qp, desc->cookie, END_RX_HEADROOM, desc->len)))
+		{
+			return NULL;
+		}
+		if (desc->hdr.flags & VIRTIO_NET_HDR_F_DATA_VALID)
+		{
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+		}
+		if (virtio_net_hdr_to_skb(skb, &desc->hdr, true)) // Offsets therein are from the Ethernet header
+		{
+			dev_kfree_skb(skb);
+			return NULL;
+		}
+		skb->protocol = eth_type_trans(skb, dev);
+	}
+	else
+	{
+		// VNIC Hack: skb is the transmitted one as is. So, scrub it for this end, as veth does
+		skb = desc->skb;
+		skb_scrub_packet(skb, !net_eq(dev_net(dev), dev_net(skb->dev)));
+		skb->priority = 0;
+		skb->protocol = eth_type_trans(skb, dev);
+	}
+	if ((!(dev->features & NETIF_F_RXCSUM)) && (!skb_is_gso(skb))) // Super-pkt can only be CHECKSUM_PARTIAL
+	{
+		if ((skb->ip_summed == CHECKSUM_PARTIAL) && (skb_checksum_help(skb)))
+		{
+			dev_kfree_skb(skb);
+			return NULL;
+		}
+		skb->ip_summed = CHECKSUM_NONE;
+	}
+	return skb;
+}
+/*
+ * Fill in the checksum yet to be (CHECKSUM_PARTIAL) of the pkt in the rx buffer itself, as a NIC's tx checksum
+ * offload would have, as XDP sees the pkt as is, & may even change it, invalidating the offsets of its offloads
+ */
+static int end_rx_csum_help(NicDesc *desc)
 {
-	strlcpy(info->driver, "end", sizeof(info->driver));
-	strlcpy(info->bus_info, "VNIC", sizeof(info->bus_info));
+	unsigned int start, offset;
+	__sum16 *csum;
+
+	if (desc->hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) // Not expected, as the NIC segments the super-pkts
+	{
+		return -EINVAL;
+	}
+	if (!(desc->hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM))
+	{
+		return 0;
+	}
+	start = __virtio16_to_cpu(true, desc->hdr.csum_start);
+	offset = start + __virtio16_to_cpu(true, desc->hdr.csum_offset);
+	if (offset + sizeof(__sum16) > desc->len)
+	{
+		return -EINVAL;
+	}
+	csum = (__sum16 *)(desc->addr + offset);
+	*csum = csum_fold(csum_partial(desc->addr + start, desc->len - start, 0)) ?: CSUM_MANGLED_0;
+	return 0;
 }
 
-static const struct ethtool_ops end_ethtool_ops =
+static inline int end_tx_is_xdp(void *cookie)
 {
-	.get_drvinfo = end_get_drvinfo,
-};
+	return (unsigned long)(cookie) & END_TX_XDP;
+}
+static inline struct xdp_frame *end_tx_xdp_frame(void *cookie)
+{
+	return (struct xdp_frame *)((unsigned long)(cookie) & ~END_TX_XDP);
+}
 
-static int end_poll(struct napi_struct *napi_ptr, int budget)
+static void end_free_buffers(QueuePvt *qp) // Of all the descriptors not reaped, as well as the rx buffer pool
 {
-	DrvPvt *pvt = container_of(napi_ptr, DrvPvt, napi);
-	struct net_device *dev = pvt->ndev;
-	unsigned int work_done;
-	struct sk_buff *skb;
+	unsigned int xsk_frames;
+	NicDesc desc;
 
-	iprintk("poll\n");
-	work_done = 0;
-	while ((work_done < budget) && (skb = nic_hw_rx_pkt()))
+	xsk_frames = 0;
+	while (!nic_hw_tx_reclaim(qp->pvt->nic, qp->qid, &desc))
 	{
-		display_packet(skb);
-		dev->stats.rx_packets++;
-		dev->stats.rx_bytes += skb->len;
-		napi_gro_receive(&pvt->napi, skb); // Handover to the network stack
-		work_done++;
+		if (desc.skb) // skb mode: Not yet transmitted
+		{
+			dev_kfree_skb(desc.skb);
+		}
+		if (desc.cookie) // Descriptor mode: skb, XDP frame or umem buffer of the tx buffer. skb mode: Timestamp clone
+		{
+			if (desc.cookie == END_TX_XSK)
+			{
+				xsk_frames++;
+			}
+			else if (end_tx_is_xdp(desc.cookie))
+			{
+				xdp_return_frame(end_tx_xdp_frame(desc.cookie));
+			}
+			else
+			{
+				dev_kfree_skb(desc.cookie);
+			}
+		}
+	}
+	while (!nic_hw_rx_reclaim(qp->pvt->nic, qp->qid, &desc))
+	{
+		if (desc.skb) // skb mode: Received but not yet reaped
+		{
+			dev_kfree_skb(desc.skb);
+		}
+		if (desc.cookie) // Descriptor mode: Page or umem buffer of the rx buffer
+		{
+			if (qp->xsk_pool)
+			{
+				xsk_buff_free(desc.cookie);
+			}
+			else
+			{
+				page_pool_put_full_page(qp->page_pool, desc.cookie, false);
+			}
+		}
+	}
+	xsk_frames += qp->xsk_tx_dropped; // Behind the ones reclaimed above, as peeked after them
+	qp->xsk_tx_dropped = 0;
+	if (xsk_frames) // Back to the user, through the completion ring
+	{
+		xsk_tx_completed(qp->xsk_pool, xsk_frames);
 	}
-	if (work_done < budget) {
-		napi_complete(napi_ptr);
-		nic_hw_enable_intr();
+	if (xdp_rxq_info_is_reg(&qp->xdp_rxq))
+	{
+		xdp_rxq_info_unreg(&qp->xdp_rxq);
+	}
+	if (qp->page_pool)
+	{
+		page_pool_destroy(qp->page_pool);
+		qp->page_pool = NULL;
 	}
-	return work_done;
 }
 
-static int end_init(void)
+/*
+ * Set up & tear down of the buffers & the NIC, w/o touching the stats. Also, for the reconfigurations
+ * (w/ the rings to be reallocated or refilled) of a running interface, as end_down(), apply, & end_up()
+ */
+static int end_up(struct net_device *dev) // Cleans up by itself, on failure
 {
-	struct net_device *dev;
-	DrvPvt *pvt;
+	DrvPvt *pvt = netdev_priv(dev);
 	int i, ret;
 
-	iprintk("init\n");
+	if ((ret = nic_setup_buffers(pvt->nic)))
+	{
+		return ret;
+	}
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		if ((pvt->desc_mode) && ((ret = end_rx_pool_create(&pvt->queues[i]))))
+		{
+			eprintk("rx page pool creation failed w/ error %d\n", ret);
+			while (i--)
+			{
+				end_free_buffers(&pvt->queues[i]);
+			}
+			nic_cleanup_buffers(pvt->nic);
+			return ret;
+		}
+		end_rx_refill(&pvt->queues[i]);
+	}
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		napi_enable(&pvt->queues[i].napi);
+		nic_register_handler(pvt->nic, i, handler, &pvt->queues[i]);
+	}
+	nic_hw_init(pvt->nic);
+	pvt->up = 1;
+	return 0;
+}
+static void end_down(struct net_device *dev)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	int i;
 
-	dev = alloc_etherdev(sizeof(DrvPvt));
-	if (!dev)
+	if (!pvt->up) // Already, as a reconfiguration failed to bring it back up
 	{
-		eprintk("device allocation failed\n");
-		return -ENOMEM;
+		return;
 	}
-	pvt = netdev_priv(dev);
-	pvt->ndev = dev;
-	netif_napi_add(dev, &pvt->napi, end_poll, END_NAPI_WEIGHT);
-	// Setting up some MAC Addr - 00:01:02:03:04:05 to be specific
-	for (i = 0; i < dev->addr_len; i++)
+	pvt->up = 0;
+	nic_hw_shut(pvt->nic);
+	for (i = 0; i < pvt->num_queues; i++)
 	{
-		dev->dev_addr[i] = i;
+		nic_unregister_handler(pvt->nic, i);
+		napi_disable(&pvt->queues[i].napi);
 	}
-	dev->netdev_ops = &end_netdev_ops;
-	//dev->ethtool_ops = &end_ethtool_ops;
-	if ((ret = register_netdev(dev)))
+	for (i = 0; i < pvt->num_queues; i++)
 	{
-		eprintk("%s network interface registration failed w/ error %i\n", dev->name, ret);
-		free_netdev(dev);
+		end_free_buffers(&pvt->queues[i]); // In turn, also clears the pkts, if any
+	}
+	nic_cleanup_buffers(pvt->nic);
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+	}
+}
+static int end_open(struct net_device *dev)
+{
+	iprintk("open\n");
+	return end_up(dev);
+}
+static int end_close(struct net_device *dev)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	int i;
+
+	iprintk("close\n");
+	end_down(dev);
+	for (i = 0; i < pvt->num_queues; i++) // Clear the stats
+	{
+		vnic_stats_clear(&pvt->queues[i].tx_stats);
+		vnic_stats_clear(&pvt->queues[i].rx_stats);
+		end_xdp_stats_clear(&pvt->queues[i].xdp_stats);
+		end_events_clear(&pvt->queues[i].tx_events);
+		end_events_clear(&pvt->queues[i].napi_events);
+		end_events_clear(&pvt->queues[i].intr_events);
+	}
+	return 0;
+}
+static inline void end_tx_kick(QueuePvt *qp) // Ring the doorbell. Under the tx queue lock
+{
+	end_events_add(&qp->tx_events, END_TX_DOORBELLS, 1);
+	nic_hw_tx_kick(qp->pvt->nic, qp->qid);
+}
+// Stop, instead of dropping later, if there may not be room for the next pkt. Woken up on tx completions
+static int end_tx_stop_on_room(QueuePvt *qp, struct netdev_queue *txq) // Returns non-zero, if stopped
+{
+	if (nic_hw_tx_room(qp->pvt->nic, qp->qid) >= END_TX_STOP_THRESH)
+	{
+		return 0;
+	}
+	netif_tx_stop_queue(txq);
+	smp_mb(); // Order the stop above w/ the room check below, against the reverse order in tx clean
+	if (nic_hw_tx_room(qp->pvt->nic, qp->qid) >= END_TX_WAKE_THRESH) // Room got made in between
+	{
+		netif_tx_start_queue(txq);
+		return 0;
+	}
+	end_events_add(&qp->tx_events, END_TX_RING_FULL, 1);
+	trace_vnic_ring_full(qp->pvt->ndev, qp->qid, nic_hw_tx_room(qp->pvt->nic, qp->qid));
+	return 1;
+}
+/*
+ * Get the pkt timestamped by the NIC on its transmission, through its last descriptor.
+ * The timestamp is reported on the tx completion, w/ the skb itself in the descriptor mode. But in the skb mode,
+ * the skb itself is handed over to the NIC. So, w/ its clone holding on to the socket, as a PHY timestamper does
+ */
+static void end_tx_tstamp_req(DrvPvt *pvt, struct sk_buff *skb, NicDesc *last)
+{
+	if (!pvt->desc_mode)
+	{
+		if (!(last->cookie = skb_clone_sk(skb))) // Just no hw timestamp, then
+		{
+			return;
+		}
+	}
+	skb_shinfo(skb)->tx_flags |= SKBTX_IN_PROGRESS;
+	last->flags |= NIC_DESC_TSTAMP;
+}
+static inline void end_hwtstamp(struct skb_shared_hwtstamps *hwts, u64 tstamp)
+{
+	// VNIC Hack: NIC stamps w/ the monotonic clock, in absence of a PHC. So, as the system time for the user
+	hwts->hwtstamp = ktime_mono_to_real(ns_to_ktime(tstamp));
+}
+static int end_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	unsigned int qid = skb_get_queue_mapping(skb);
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, qid);
+	NicDesc *desc = pvt->queues[qid].tx_desc;
+	unsigned int i, n;
+	int len, kick;
+
+	tprintk("tx\n");
+	pkt_trace_display(skb);
+	capture_pkt(&pvt->capture, skb, qid, CAPTURE_DIR_TX);
+	len = skb->len; // HACK: To avoid using skb after packet transmission
+	n = pvt->desc_mode ? 1 + skb_shinfo(skb)->nr_frags : 1;
+	memset(desc, 0, n * sizeof(*desc));
+	if (pvt->desc_mode)
+	{
+		/*
+		 * Scatter-gather: One descriptor for the head & one per frag, so as not to linearize (copy) the pkt.
+		 * Offloads (checksum, segmentation) to be done by the NIC, as described in the first one.
+		 * Can't fail, as the ones which can't be described are left to the stack by end_features_check()
+		 */
+		if (virtio_net_hdr_from_skb(skb, &desc[0].hdr, true, true, 0))
+		{
+			vnic_stats_add(&pvt->queues[qid].tx_stats, 0, 0, 1);
+			dev_kfree_skb(skb);
+			if (!netdev_xmit_more()) // Earlier pkts of the burst, if any, still need the doorbell
+			{
+				end_tx_kick(&pvt->queues[qid]);
+			}
+			return 0;
+		}
+		// VNIC Hack: No DMA address. And frags are in lowmem, as no NETIF_F_HIGHDMA
+		desc[0].addr = skb->data;
+		desc[0].len = skb_headlen(skb);
+		for (i = 1; i < n; i++)
+		{
+			desc[i].addr = skb_frag_address(&skb_shinfo(skb)->frags[i - 1]);
+			desc[i].len = skb_frag_size(&skb_shinfo(skb)->frags[i - 1]);
+		}
+		desc[n - 1].cookie = skb; // To be freed on its tx completion, i.e. of its last descriptor
 	}
 	else
 	{
-		npvt = pvt; // Hack using global variable in absence of a horizontal layer
+		desc[0].skb = skb; // VNIC Hack: Hand over the skb itself, along w/ its frags, if any
+		desc[0].len = len;
 	}
-	return ret;
+	desc[n - 1].flags = NIC_DESC_EOP;
+	if ((skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP) && (READ_ONCE(pvt->tstamp_config.tx_type) == HWTSTAMP_TX_ON))
+	{
+		end_tx_tstamp_req(pvt, skb, &desc[n - 1]);
+	}
+	skb_tx_timestamp(skb); // Software one, unless the hw one is in progress
+	/*
+	 * Account w/ BQL before putting, as its completion may follow right thereafter.
+	 * Kick (ring the doorbell) only for the last pkt of a burst from the stack, or if the queue got stopped
+	 */
+	kick = __netdev_tx_sent_queue(txq, len, netdev_xmit_more());
+	if (nic_hw_tx_post(pvt->nic, qid, desc, n)) // NIC not ready & hence dropped
+	{
+		vnic_stats_add(&pvt->queues[qid].tx_stats, 0, 0, 1);
+		if ((!pvt->desc_mode) && (desc[0].cookie)) // Timestamp clone
+		{
+			kfree_skb(desc[0].cookie);
+		}
+		dev_kfree_skb(skb);
+	}
+	else
+	{
+		vnic_stats_add(&pvt->queues[qid].tx_stats, 1, len, 0);
+		if (trace_vnic_xmit_enabled())
+		{
+			trace_vnic_xmit(dev, qid, len, n, nic_hw_tx_room(pvt->nic, qid));
+		}
+	}
+	if (end_tx_stop_on_room(&pvt->queues[qid], txq))
+	{
+		kick = 1;
+	}
+	if (kick)
+	{
+		end_tx_kick(&pvt->queues[qid]);
+	}
+	return 0;
 }
-static void end_exit(void)
+/*
+ * Post the XDP frames into the tx ring of the queue, sharing it w/ the stack's pkts, w/ one doorbell for all.
+ * Returns the number of frames posted, from the first. Tx queue lock to be held
+ */
+static int end_xdp_tx_post(QueuePvt *qp, struct xdp_frame **frames, int n)
 {
-	DrvPvt *pvt = npvt;
-	struct net_device *dev = pvt->ndev;
+	NicDesc desc = {}; // No offloads
+	unsigned int bytes;
+	int i;
 
-	iprintk("exit\n");
-	unregister_netdev(dev);
-	netif_napi_del(&pvt->napi);
-	free_netdev(dev);
+	bytes = 0;
+	for (i = 0; i < n; i++)
+	{
+		desc.addr = frames[i]->data; // VNIC Hack: No DMA address
+		desc.len = frames[i]->len;
+		desc.cookie = (void *)((unsigned long)(frames[i]) | END_TX_XDP); // To be returned on its tx completion
+		desc.flags = NIC_DESC_EOP;
+		if (nic_hw_tx_post(qp->pvt->nic, qp->qid, &desc, 1)) // Full or NIC not ready
+		{
+			break;
+		}
+		bytes += desc.len;
+	}
+	if (i)
+	{
+		vnic_stats_add(&qp->tx_stats, i, bytes, 0);
+		end_tx_stop_on_room(qp, netdev_get_tx_queue(qp->pvt->ndev, qp->qid));
+		end_tx_kick(qp);
+	}
+	return i;
+}
+static int end_set_mac_address(struct net_device *dev, void *addr)
+{
+	iprintk("set_mac\n");
+	return eth_mac_addr(dev, addr);
+}
+static netdev_features_t end_features_check(struct sk_buff *skb, struct net_device *dev,
+						netdev_features_t features)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+
+	// Descriptor mode: Only the TCP super-pkts can be described to the NIC. Rest get segmented by the stack
+	if ((pvt->desc_mode) && (skb_is_gso(skb)) && (skb_shinfo(skb)->gso_type &
+		~(SKB_GSO_TCPV4 | SKB_GSO_TCPV6 | SKB_GSO_TCP_ECN | SKB_GSO_TCP_FIXEDID | SKB_GSO_DODGY)))
+	{
+		features &= ~NETIF_F_GSO_MASK;
+	}
+	return features;
+}
+static int end_xdp_setup(struct net_device *dev, struct bpf_prog *prog, struct netlink_ext_ack *extack)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	struct bpf_prog *old_prog;
+
+	if (!pvt->desc_mode) // No rx buffers to run it on. Generic XDP, if needed
+	{
+		NL_SET_ERR_MSG_MOD(extack, "Native XDP needs the NIC in descriptor mode (nic desc_mode=1)");
+		return -EOPNOTSUPP;
+	}
+	old_prog = rtnl_dereference(pvt->xdp_prog);
+	rcu_assign_pointer(pvt->xdp_prog, prog); // Picked up by the polls from their next run
+	if (old_prog)
+	{
+		bpf_prog_put(old_prog); // Freed after an RCU grace period, i.e. once no poll is running it
+	}
+	return 0;
+}
+/*
+ * XDP frames redirected into this device, from anywhere (ndo_xdp_xmit), in bulks from the XDP core.
+ * Posted on the tx ring of the queue of this CPU, w/ one doorbell per bulk, to be delivered to the peer.
+ * Returns the number of frames posted, from the first. Rest are freed by the caller
+ */
+static int end_xdp_xmit(struct net_device *dev, int n, struct xdp_frame **frames, u32 flags)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	unsigned int cpu = smp_processor_id();
+	QueuePvt *qp = &pvt->queues[cpu % pvt->num_queues];
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, qp->qid);
+	int nxmit;
+
+	if (flags & ~XDP_XMIT_FLAGS_MASK)
+	{
+		return -EINVAL;
+	}
+	if (!pvt->desc_mode) // NIC takes only skbs
+	{
+		return -EOPNOTSUPP;
+	}
+	__netif_tx_lock(txq, cpu); // Shared w/ the stack's xmit & XDP_TX of the queue
+	nxmit = end_xdp_tx_post(qp, frames, n);
+	if (nxmit < n) // No room
+	{
+		vnic_stats_add(&qp->tx_stats, 0, 0, n - nxmit);
+	}
+	__netif_tx_unlock(txq);
+	return nxmit;
+}
+/*
+ * Bind (or unbind, w/ NULL) an AF_XDP socket's buffer pool to the queue, for its rx & tx in zero-copy.
+ * The queue's rx ring gets filled up from the umem, & its tx ring from the socket's tx ring
+ */
+static int end_xsk_pool_setup(struct net_device *dev, struct xsk_buff_pool *pool, u16 qid)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	struct xsk_buff_pool *old_pool;
+	int ret;
+
+	if (!pvt->desc_mode) // No buffers to be zero-copied. Copy mode, if needed
+	{
+		return -EOPNOTSUPP;
+	}
+	if (qid >= pvt->num_queues)
+	{
+		return -EINVAL;
+	}
+	if ((pool) && (xsk_pool_get_rx_frame_size(pool) < dev->mtu + ETH_HLEN)) // Too small for a pkt
+	{
+		return -EINVAL;
+	}
+	old_pool = pvt->queues[qid].xsk_pool;
+	if (!netif_running(dev))
+	{
+		WRITE_ONCE(pvt->queues[qid].xsk_pool, pool);
+		return 0;
+	}
+	// Rings get refilled w/ the buffers from the new pool, on the buffers' set up. W/o touching the stats
+	netif_tx_disable(dev);
+	end_down(dev);
+	WRITE_ONCE(pvt->queues[qid].xsk_pool, pool);
+	if (((ret = end_up(dev))) && (pool)) // Binding. So, back to the old pool
+	{
+		eprintk("%s buffers' set up w/ the new pool failed w/ error %d. Reverting\n", dev->name, ret);
+		WRITE_ONCE(pvt->queues[qid].xsk_pool, old_pool);
+		if (!end_up(dev))
+		{
+			netif_tx_wake_all_queues(dev);
+			return ret;
+		}
+	}
+	// Unbinding (w/ the pool being released by the socket anyway), or the old one failing as well
+	if (ret) // So, down for good, rather than up w/o the buffers
+	{
+		eprintk("%s buffers' set up failed w/ error %d. Closing\n", dev->name, ret);
+		dev_close(dev);
+		return ret;
+	}
+	netif_tx_wake_all_queues(dev);
+	return 0;
+}
+static int end_xsk_wakeup(struct net_device *dev, u32 qid, u32 flags) // From the AF_XDP socket, for rx &/or tx
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	QueuePvt *qp;
+
+	if (!netif_running(dev))
+	{
+		return -ENETDOWN;
+	}
+	if (qid >= pvt->num_queues)
+	{
+		return -EINVAL;
+	}
+	qp = &pvt->queues[qid];
+	if (!READ_ONCE(qp->xsk_pool))
+	{
+		return -ENXIO;
+	}
+	if (!napi_if_scheduled_mark_missed(&qp->napi)) // Else, would be polled again anyway
+	{
+		local_bh_disable();
+		nic_hw_disable_intr(qp->pvt->nic, qp->qid); // As if interrupted
+		napi_schedule(&qp->napi);
+		local_bh_enable();
+	}
+	return 0;
+}
+static int end_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+	switch (bpf->command)
+	{
+		case XDP_SETUP_PROG:
+			return end_xdp_setup(dev, bpf->prog, bpf->extack);
+		case XDP_SETUP_XSK_POOL:
+			return end_xsk_pool_setup(dev, bpf->xsk.pool, bpf->xsk.queue_id);
+		default:
+			return -EINVAL;
+	}
+}
+static int end_hwtstamp_set(struct net_device *dev, struct ifreq *ifr)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	struct hwtstamp_config config;
+
+	if (copy_from_user(&config, ifr->ifr_data, sizeof(config)))
+	{
+		return -EFAULT;
+	}
+	if (config.flags)
+	{
+		return -EINVAL;
+	}
+	switch (config.tx_type)
+	{
+		case HWTSTAMP_TX_OFF:
+		case HWTSTAMP_TX_ON:
+			break;
+		default:
+			return -ERANGE;
+	}
+	if (config.rx_filter != HWTSTAMP_FILTER_NONE) // NIC stamps all or none. So, all for any filter
+	{
+		config.rx_filter = HWTSTAMP_FILTER_ALL;
+	}
+	// Config first, so that the poll never misses the NIC's stamping, & skips the unstamped ones
+	WRITE_ONCE(pvt->tstamp_config.tx_type, config.tx_type);
+	WRITE_ONCE(pvt->tstamp_config.rx_filter, config.rx_filter);
+	nic_hw_set_rx_tstamp(pvt->nic, config.rx_filter != HWTSTAMP_FILTER_NONE);
+	return copy_to_user(ifr->ifr_data, &config, sizeof(config)) ? -EFAULT : 0;
+}
+static int end_eth_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+
+	switch (cmd)
+	{
+		case SIOCSHWTSTAMP:
+			return end_hwtstamp_set(dev, ifr);
+		case SIOCGHWTSTAMP:
+			return copy_to_user(ifr->ifr_data, &pvt->tstamp_config, sizeof(pvt->tstamp_config)) ? -EFAULT : 0;
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+static void end_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *stats)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	u64 pkts, bytes, dropped;
+	u64 xdp_actions[END_XDP_ACTIONS], xdp_errors;
+	int i;
+
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		vnic_stats_fetch(&pvt->queues[i].tx_stats, &pkts, &bytes, &dropped);
+		stats->tx_packets += pkts;
+		stats->tx_bytes += bytes;
+		stats->tx_dropped += dropped;
+		vnic_stats_fetch(&pvt->queues[i].rx_stats, &pkts, &bytes, &dropped);
+		stats->rx_packets += pkts;
+		stats->rx_bytes += bytes;
+		stats->rx_dropped += dropped;
+		end_xdp_stats_fetch(&pvt->queues[i].xdp_stats, xdp_actions, &xdp_errors);
+		stats->rx_dropped += xdp_actions[XDP_ABORTED] + xdp_actions[XDP_DROP] + xdp_errors;
+	}
+}
+
+static const struct net_device_ops end_netdev_ops =
+{
+	.ndo_open = end_open,
+	.ndo_stop = end_close,
+	.ndo_start_xmit = end_start_xmit,
+	.ndo_set_mac_address = end_set_mac_address,
+	.ndo_get_stats64 = end_get_stats64,
+	.ndo_features_check = end_features_check,
+	.ndo_bpf = end_bpf,
+	.ndo_xdp_xmit = end_xdp_xmit,
+	.ndo_xsk_wakeup = end_xsk_wakeup,
+	.ndo_eth_ioctl = end_eth_ioctl,
+};
+
+static void end_get_drvinfo(struct net_device *dev, struct ethtool_drvinfo *info)
+{
+	strlcpy(info->driver, "end", sizeof(info->driver));
+	strlcpy(info->bus_info, "VNIC", sizeof(info->bus_info));
+}
+
+static int end_get_coalesce(struct net_device *dev, struct ethtool_coalesce *ec,
+				struct kernel_ethtool_coalesce *kec, struct netlink_ext_ack *extack)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+
+	nic_hw_get_coalesce(pvt->nic, &ec->rx_coalesce_usecs, &ec->rx_max_coalesced_frames);
+	return 0;
+}
+static int end_set_coalesce(struct net_device *dev, struct ethtool_coalesce *ec,
+				struct kernel_ethtool_coalesce *kec, struct netlink_ext_ack *extack)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+
+	return nic_hw_set_coalesce(pvt->nic, ec->rx_coalesce_usecs, ec->rx_max_coalesced_frames);
+}
+
+static void end_get_ringparam(struct net_device *dev, struct ethtool_ringparam *ring)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+
+	ring->tx_max_pending = NIC_MAX_DESC;
+	ring->rx_max_pending = NIC_MAX_DESC;
+	nic_hw_get_ring_size(pvt->nic, &ring->tx_pending, &ring->rx_pending);
+}
+static int end_set_ringparam(struct net_device *dev, struct ethtool_ringparam *ring)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	unsigned int tx, rx;
+	int ret;
+
+	nic_hw_get_ring_size(pvt->nic, &tx, &rx);
+	if ((ret = nic_hw_set_ring_size(pvt->nic, ring->tx_pending, ring->rx_pending)))
+	{
+		return ret;
+	}
+	if (!netif_running(dev))
+	{
+		return 0;
+	}
+	// Rings get reallocated w/ the new sizes, on the buffers' set up. W/o touching the stats
+	netif_tx_disable(dev);
+	end_down(dev);
+	if ((ret = end_up(dev))) // E.g. no memory for the bigger rings. So, back to the old ones
+	{
+		eprintk("%s rings' set up failed w/ error %d. Reverting to %u/%u\n", dev->name, ret, tx, rx);
+		nic_hw_set_ring_size(pvt->nic, tx, rx);
+		if (end_up(dev)) // Not even w/ the old ones. So, down for good, rather than up w/o the buffers
+		{
+			eprintk("%s rings' set up failed again. Closing\n", dev->name);
+			dev_close(dev);
+			return ret;
+		}
+	}
+	netif_tx_wake_all_queues(dev);
+	return ret;
+}
+
+/* Per queue tx counters: QueueStats, followed by the tx events, in order of their END_TX_* */
+static const char end_tx_stat_names[][ETH_GSTRING_LEN] =
+{
+	"packets", "bytes", "dropped", "ring_full", "doorbells"
+};
+#define END_TX_STATS ARRAY_SIZE(end_tx_stat_names)
+/*
+ * Per queue rx counters: QueueStats, followed by the interrupts, the napi events, in order of their END_NAPI_*,
+ * & the average batch
+ */
+static const char end_rx_stat_names[][ETH_GSTRING_LEN] =
+{
+	"packets", "bytes", "dropped", "interrupts", "polls", "budget_exhausted", "poll_work", "avg_batch"
+};
+#define END_RX_STATS ARRAY_SIZE(end_rx_stat_names)
+/* Per queue XDP counters: Actions, in order of their values, followed by the errors */
+static const char end_xdp_stat_names[][ETH_GSTRING_LEN] =
+{
+	"xdp_aborted", "xdp_drop", "xdp_pass", "xdp_tx", "xdp_redirect", "xdp_errors"
+};
+#define END_XDP_STATS ARRAY_SIZE(end_xdp_stat_names)
+
+/* Private flags, in order of their bits */
+static const char end_priv_flag_names[][ETH_GSTRING_LEN] =
+{
+	"pkt-trace" // Pkt tracing of the fast paths, of all the interfaces, as through the pkt_trace module parameter
+};
+#define END_PRIV_FLAG_PKT_TRACE BIT(0)
+
+static int end_get_sset_count(struct net_device *dev, int sset)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+
+	switch (sset)
+	{
+		case ETH_SS_STATS:
+			return pvt->num_queues * (END_TX_STATS + END_RX_STATS + END_XDP_STATS);
+		case ETH_SS_PRIV_FLAGS:
+			return ARRAY_SIZE(end_priv_flag_names);
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+static void end_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	int i, j;
+
+	if (sset == ETH_SS_PRIV_FLAGS)
+	{
+		memcpy(data, end_priv_flag_names, sizeof(end_priv_flag_names));
+		return;
+	}
+	if (sset != ETH_SS_STATS)
+	{
+		return;
+	}
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		for (j = 0; j < END_TX_STATS; j++)
+		{
+			ethtool_sprintf(&data, "tx%d_%s", i, end_tx_stat_names[j]);
+		}
+		for (j = 0; j < END_RX_STATS; j++)
+		{
+			ethtool_sprintf(&data, "rx%d_%s", i, end_rx_stat_names[j]);
+		}
+		for (j = 0; j < END_XDP_STATS; j++)
+		{
+			ethtool_sprintf(&data, "rx%d_%s", i, end_xdp_stat_names[j]);
+		}
+	}
+}
+static void end_get_ethtool_stats(struct net_device *dev, struct ethtool_stats *stats, u64 *data)
+{
+	DrvPvt *pvt = netdev_priv(dev);
+	QueuePvt *qp;
+	int i;
+
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		qp = &pvt->queues[i];
+		vnic_stats_fetch(&qp->tx_stats, &data[0], &data[1], &data[2]);
+		end_events_fetch(&qp->tx_events, &data[3], END_TX_EVENTS);
+		data += END_TX_STATS;
+		vnic_stats_fetch(&qp->rx_stats, &data[0], &data[1], &data[2]);
+		end_events_fetch(&qp->intr_events, &data[3], END_INTR_EVENTS);
+		end_events_fetch(&qp->napi_events, &data[4], END_NAPI_EVENTS);
+		data[4 + END_NAPI_EVENTS] = data[4 + END_NAPI_POLLS] ?
+			div64_u64(data[4 + END_NAPI_WORK], data[4 + END_NAPI_POLLS]) : 0;
+		data += END_RX_STATS;
+		end_xdp_stats_fetch(&qp->xdp_stats, data, &data[END_XDP_ACTIONS]);
+		data += END_XDP_STATS;
+	}
+}
+static u32 end_get_priv_flags(struct net_device *dev)
+{
+	return READ_ONCE(pkt_trace) ? END_PRIV_FLAG_PKT_TRACE : 0;
+}
+static int end_set_priv_flags(struct net_device *dev, u32 flags)
+{
+	if (flags & END_PRIV_FLAG_PKT_TRACE)
+	{
+		if (!READ_ONCE(pkt_trace)) // Every pkt, unless already sampling through the module parameter
+		{
+			pkt_trace_set(1);
+		}
+	}
+	else
+	{
+		pkt_trace_set(0);
+	}
+	return 0;
+}
+static int end_get_ts_info(struct net_device *dev, struct ethtool_ts_info *info)
+{
+	info->so_timestamping = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	info->phc_index = -1; // No PHC, as the NIC stamps w/ the system clock
+	info->tx_types = BIT(HWTSTAMP_TX_OFF) | BIT(HWTSTAMP_TX_ON);
+	info->rx_filters = BIT(HWTSTAMP_FILTER_NONE) | BIT(HWTSTAMP_FILTER_ALL);
+	return 0;
+}
+
+static const struct ethtool_ops end_ethtool_ops =
+{
+	.supported_coalesce_params = ETHTOOL_COALESCE_RX_USECS | ETHTOOL_COALESCE_RX_MAX_FRAMES,
+	.get_drvinfo = end_get_drvinfo,
+	.get_coalesce = end_get_coalesce,
+	.set_coalesce = end_set_coalesce,
+	.get_ringparam = end_get_ringparam,
+	.set_ringparam = end_set_ringparam,
+	.get_sset_count = end_get_sset_count,
+	.get_strings = end_get_strings,
+	.get_ethtool_stats = end_get_ethtool_stats,
+	.get_ts_info = end_get_ts_info,
+	.get_priv_flags = end_get_priv_flags,
+	.set_priv_flags = end_set_priv_flags,
+};
+
+static void end_tx_clean(QueuePvt *qp, int budget)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(qp->pvt->ndev, qp->qid);
+	unsigned int reaped, pkts, bytes, xsk_frames;
+	struct skb_shared_hwtstamps hwts = {};
+	NicDesc desc;
+
+	reaped = pkts = bytes = xsk_frames = 0;
+	while (!nic_hw_tx_reap(qp->pvt->nic, qp->qid, &desc))
+	{
+		reaped++;
+		// XDP frames & umem buffers are not accounted w/ BQL, as not from the stack
+		if (desc.cookie == END_TX_XSK)
+		{
+			xsk_frames++;
+			continue;
+		}
+		if ((desc.cookie) && (end_tx_is_xdp(desc.cookie)))
+		{
+			xdp_return_frame(end_tx_xdp_frame(desc.cookie));
+			continue;
+		}
+		if (desc.flags & NIC_DESC_EOP) // Last descriptor of a pkt
+		{
+			pkts++;
+		}
+		bytes += desc.len;
+		if (desc.flags & NIC_DESC_TSTAMP) // Cookie has the skb (descriptor mode), or its clone (skb mode)
+		{
+			end_hwtstamp(&hwts, desc.tstamp);
+			if (qp->pvt->desc_mode)
+			{
+				skb_tstamp_tx(desc.cookie, &hwts);
+			}
+			else
+			{
+				skb_complete_tx_timestamp(desc.cookie, &hwts); // Consumes the clone
+				continue;
+			}
+		}
+		if (desc.cookie) // Descriptor mode: Done w/ the skb of the tx buffer
+		{
+			napi_consume_skb(desc.cookie, budget);
+		}
+	}
+	if (!reaped)
+	{
+		return;
+	}
+	if (xsk_frames) // Back to the user, through the completion ring
+	{
+		xsk_tx_completed(qp->xsk_pool, xsk_frames);
+	}
+	if (pkts)
+	{
+		trace_vnic_tx_done(qp->pvt->ndev, qp->qid, pkts, bytes);
+		netdev_tx_completed_queue(txq, pkts, bytes);
+	}
+	smp_mb(); // Order the room made w/ the stopped check below, against the reverse order in xmit
+	if ((netif_tx_queue_stopped(txq)) && (nic_hw_tx_room(qp->pvt->nic, qp->qid) >= END_TX_WAKE_THRESH))
+	{
+		netif_tx_wake_queue(txq);
+	}
+}
+
+static void end_xdp_tx_flush(QueuePvt *qp, unsigned int *errors) // XDP_TX frames so far, onto the own tx ring
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(qp->pvt->ndev, qp->qid);
+	int i, n;
+
+	__netif_tx_lock(txq, smp_processor_id()); // Shared w/ the stack's xmit
+	n = end_xdp_tx_post(qp, qp->xdp_tx, qp->xdp_tx_cnt);
+	__netif_tx_unlock(txq);
+	for (i = n; i < qp->xdp_tx_cnt; i++) // No room. So, dropped
+	{
+		xdp_return_frame_rx_napi(qp->xdp_tx[i]);
+	}
+	*errors += qp->xdp_tx_cnt - n;
+	qp->xdp_tx_cnt = 0;
+}
+static void end_rx_xdp_free(QueuePvt *qp, struct xdp_buff *xdp) // Rx buffer back to its pool
+{
+	if (qp->xsk_pool)
+	{
+		xsk_buff_free(xdp);
+	}
+	else
+	{
+		page_pool_recycle_direct(qp->page_pool, virt_to_head_page(xdp->data));
+	}
+}
+static struct sk_buff *end_rx_xsk_skb(QueuePvt *qp, struct xdp_buff *xdp) // Copied out, as the umem is the user's
+{
+	unsigned int metasize = xdp->data - xdp->data_meta;
+	unsigned int len = xdp->data_end - xdp->data;
+	struct sk_buff *skb;
+
+	if (!(skb = napi_alloc_skb(&qp->napi, metasize + len)))
+	{
+		xsk_buff_free(xdp);
+		return NULL;
+	}
+	skb_put_data(skb, xdp->data_meta, metasize + len);
+	if (metasize)
+	{
+		__skb_pull(skb, metasize);
+		skb_metadata_set(skb, metasize);
+	}
+	xsk_buff_free(xdp);
+	return skb;
+}
+/*
+ * Run the XDP program, if any, on the received rx buffer, before any skb gets built around it.
+ * The buffer is from the page pool, or from the umem of the bound AF_XDP socket, if any.
+ * Returns the skb for the stack, only for XDP_PASS. Else, the buffer is consumed as per the verdict
+ */
+static struct sk_buff *end_rx_xdp(QueuePvt *qp, struct bpf_prog *prog, NicDesc *desc,
+					unsigned int *actions, unsigned int *errors, int *redirected)
+{
+	struct net_device *dev = qp->pvt->ndev;
+	struct xdp_buff xdp_page, *xdp;
+	struct xdp_frame *xdpf;
+	struct sk_buff *skb;
+	unsigned int metasize;
+	u32 act;
+
+	if (qp->xsk_pool)
+	{
+		xdp = desc->cookie;
+		xdp->data_end = xdp->data + desc->len;
+		xsk_buff_dma_sync_for_cpu(xdp, qp->xsk_pool);
+	}
+	else
+	{
+		xdp = &xdp_page;
+		xdp_init_buff(xdp, PAGE_SIZE, &qp->xdp_rxq);
+		xdp_prepare_buff(xdp, page_address((struct page *)(desc->cookie)), END_RX_HEADROOM, desc->len, true);
+	}
+	if (end_rx_csum_help(desc))
+	{
+		(*errors)++;
+		end_rx_xdp_free(qp, xdp);
+		return NULL;
+	}
+	act = prog ? bpf_prog_run_xdp(prog, xdp) : XDP_PASS; // W/o a program, only for a bound AF_XDP socket
+	if (act >= END_XDP_ACTIONS)
+	{
+		bpf_warn_invalid_xdp_action(act);
+		act = XDP_ABORTED;
+	}
+	actions[act]++;
+	switch (act)
+	{
+		case XDP_PASS: // W/ the pkt as left by the program, & so, w/ its checksum to be validated by the stack
+			if (qp->xsk_pool)
+			{
+				skb = end_rx_xsk_skb(qp, xdp);
+			}
+			else
+			{
+				skb = end_rx_build_skb(qp, virt_to_head_page(xdp->data),
+							xdp->data - xdp->data_hard_start, xdp->data_end - xdp->data);
+				if ((skb) && (metasize = xdp->data - xdp->data_meta))
+				{
+					skb_metadata_set(skb, metasize);
+				}
+			}
+			if (!skb)
+			{
+				(*errors)++;
+				return NULL;
+			}
+			skb->protocol = eth_type_trans(skb, dev);
+			return skb;
+		case XDP_TX: // Back to the peer, through the own tx ring. Copied out of the umem, if from there
+			if (!(xdpf = xdp_convert_buff_to_frame(xdp)))
+			{
+				break;
+			}
+			qp->xdp_tx[qp->xdp_tx_cnt++] = xdpf;
+			if (qp->xdp_tx_cnt == END_XDP_TX_BULK)
+			{
+				end_xdp_tx_flush(qp, errors);
+			}
+			return NULL;
+		case XDP_REDIRECT: // Flushed once at the end of the poll. W/o a copy, if to the bound AF_XDP socket
+			if (xdp_do_redirect(dev, xdp, prog))
+			{
+				break;
+			}
+			*redirected = 1;
+			return NULL;
+		case XDP_DROP:
+			end_rx_xdp_free(qp, xdp);
+			return NULL;
+		case XDP_ABORTED:
+			trace_xdp_exception(dev, prog, act);
+			end_rx_xdp_free(qp, xdp);
+			return NULL;
+	}
+	(*errors)++; // Failed to carry out the XDP_TX or XDP_REDIRECT
+	trace_xdp_exception(dev, prog, act);
+	end_rx_xdp_free(qp, xdp);
+	return NULL;
+}
+/*
+ * Pkts from the tx ring of the bound AF_XDP socket, straight out of its umem (zero-copy), onto the own tx ring.
+ * Returns non-zero, if more may be pending beyond the budget
+ */
+static int end_xsk_xmit(QueuePvt *qp, unsigned int budget)
+{
+	struct xsk_buff_pool *pool = qp->xsk_pool;
+	struct netdev_queue *txq = netdev_get_tx_queue(qp->pvt->ndev, qp->qid);
+	struct xdp_desc xdesc;
+	NicDesc desc = {}; // No offloads
+	unsigned int limit, sent, bytes, dropped;
+
+	__netif_tx_lock(txq, smp_processor_id()); // Shared w/ the stack's xmit
+	limit = min(budget, nic_hw_tx_room(qp->pvt->nic, qp->qid)); // Rest on the tx completions, as they make room
+	sent = bytes = dropped = 0;
+	while ((sent < limit) && (xsk_tx_peek_desc(pool, &xdesc)))
+	{
+		desc.addr = xsk_buff_raw_get_data(pool, xdesc.addr); // VNIC Hack: No DMA address
+		desc.len = xdesc.len;
+		desc.cookie = END_TX_XSK; // Only to be completed in order, on its tx completion
+		desc.flags = NIC_DESC_EOP;
+		if (nic_hw_tx_post(qp->pvt->nic, qp->qid, &desc, 1)) // NIC not ready (going down) & hence dropped
+		{
+			qp->xsk_tx_dropped++; // Not completed right away, as the earlier ones may still be in flight
+			dropped = 1;
+			break; // No point in peeking more, only to drop them as well
+		}
+		sent++;
+		bytes += desc.len;
+	}
+	if ((sent) || (dropped))
+	{
+		xsk_tx_release(pool);
+		vnic_stats_add(&qp->tx_stats, sent, bytes, dropped);
+	}
+	if (sent)
+	{
+		end_tx_stop_on_room(qp, txq);
+		end_tx_kick(qp);
+	}
+	__netif_tx_unlock(txq);
+	if (xsk_uses_need_wakeup(pool)) // As the poll doesn't keep running for the tx
+	{
+		xsk_set_tx_need_wakeup(pool);
+	}
+	return sent == budget;
+}
+
+static int end_poll(struct napi_struct *napi_ptr, int budget)
+{
+	QueuePvt *qp = container_of(napi_ptr, QueuePvt, napi);
+	DrvPvt *pvt = qp->pvt;
+	unsigned int work_done;
+	unsigned int pkts, bytes, dropped;
+	unsigned int xdp_actions[END_XDP_ACTIONS] = {}, xdp_errors = 0;
+	int xdp_redirected = 0;
+	int xsk_pending = 0;
+	int rx_tstamp = (READ_ONCE(pvt->tstamp_config.rx_filter) != HWTSTAMP_FILTER_NONE);
+	struct bpf_prog *xdp_prog;
+	struct sk_buff *skb;
+	NicDesc desc;
+
+	tprintk("poll\n");
+	trace_vnic_poll_start(pvt->ndev, qp->qid, budget);
+	end_tx_clean(qp, budget); // Not counted against the budget
+	if (qp->xsk_pool)
+	{
+		xsk_pending = end_xsk_xmit(qp, budget);
+	}
+	work_done = 0;
+	pkts = bytes = dropped = 0;
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(pvt->xdp_prog);
+	while ((work_done < budget) && !nic_hw_rx_reap(qp->pvt->nic, qp->qid, &desc))
+	{
+		work_done++;
+		if ((xdp_prog) || (qp->xsk_pool))
+		{
+			if (!(skb = end_rx_xdp(qp, xdp_prog, &desc, xdp_actions, &xdp_errors, &xdp_redirected)))
+			{
+				continue; // Consumed by XDP, & counted thereby
+			}
+		}
+		else if (!(skb = end_rx_skb(qp, &desc)))
+		{
+			dropped++;
+			continue;
+		}
+		pkt_trace_display(skb);
+		pkts++;
+		bytes += desc.len;
+		if ((rx_tstamp) && (desc.tstamp)) // Not, if received before the NIC's stamping got on
+		{
+			end_hwtstamp(skb_hwtstamps(skb), desc.tstamp);
+		}
+		capture_pkt(&pvt->capture, skb, qp->qid, CAPTURE_DIR_RX);
+		skb_record_rx_queue(skb, qp->qid);
+		trace_vnic_rx(pvt->ndev, qp->qid, skb->len, desc.tstamp);
+		napi_gro_receive(&qp->napi, skb); // Handover to the network stack
+	}
+	if (qp->xdp_tx_cnt)
+	{
+		end_xdp_tx_flush(qp, &xdp_errors);
+	}
+	if (xdp_redirected)
+	{
+		xdp_do_flush();
+	}
+	rcu_read_unlock();
+	if (work_done) // Once per poll, rather than per pkt
+	{
+		vnic_stats_add(&qp->rx_stats, pkts, bytes, dropped);
+		if (xdp_prog)
+		{
+			end_xdp_stats_add(&qp->xdp_stats, xdp_actions, xdp_errors);
+		}
+	}
+	end_rx_refill(qp); // Replenish the reaped ones
+	nic_hw_rx_kick(qp->pvt->nic, qp->qid);
+	end_events_add(&qp->napi_events, END_NAPI_POLLS, 1);
+	end_events_add(&qp->napi_events, END_NAPI_FULL_POLLS, (xsk_pending) || (work_done == budget));
+	end_events_add(&qp->napi_events, END_NAPI_WORK, work_done);
+	poll_hist_add(&qp->poll_hist, xsk_pending ? budget : work_done, budget);
+	trace_vnic_poll_end(pvt->ndev, qp->qid, xsk_pending ? budget : work_done, budget);
+	if (xsk_pending) // Keep polling for the AF_XDP socket's tx
+	{
+		return budget;
+	}
+	if (work_done < budget)
+	{
+		/*
+		 * Unmask the interrupt only if the napi is really through. It is not, if owned by a busy poller
+		 * (SO_BUSY_POLL), or if rescheduled for being missed while polled, or if deferred by
+		 * napi_defer_hard_irqs for gro_flush_timeout, with the interrupt to be kept masked meanwhile.
+		 * And, work_done (not 0) is what gets the deferral & the gro flush timeout going
+		 */
+		if (napi_complete_done(napi_ptr, work_done))
+		{
+			nic_hw_enable_intr(qp->pvt->nic, qp->qid);
+		}
+	}
+	return work_done;
+}
+
+static void end_debugfs_init(DrvPvt *pvt)
+{
+	struct dentry *qdir;
+	QueueEvents *events;
+	char name[16];
+	int i;
+
+	pvt->dbg_dir = debugfs_create_dir(pvt->ndev->name, dbg_root);
+	capture_init(&pvt->capture, pvt->dbg_dir);
+	for (i = 0; i < pvt->num_queues; i++) // Event counters, as is (ethtool -S, where available, has them exact)
+	{
+		snprintf(name, sizeof(name), "q%d", i);
+		qdir = debugfs_create_dir(name, pvt->dbg_dir);
+		events = &pvt->queues[i].tx_events;
+		debugfs_create_u64("tx_ring_full", 0444, qdir, &events->count[END_TX_RING_FULL]);
+		debugfs_create_u64("tx_doorbells", 0444, qdir, &events->count[END_TX_DOORBELLS]);
+		events = &pvt->queues[i].intr_events;
+		debugfs_create_u64("interrupts", 0444, qdir, &events->count[END_INTR_INTERRUPTS]);
+		events = &pvt->queues[i].napi_events;
+		debugfs_create_u64("polls", 0444, qdir, &events->count[END_NAPI_POLLS]);
+		debugfs_create_u64("full_polls", 0444, qdir, &events->count[END_NAPI_FULL_POLLS]);
+		debugfs_create_u64("poll_work", 0444, qdir, &events->count[END_NAPI_WORK]);
+		// Writing anything resets
+		debugfs_create_file("work_done", 0644, qdir, &pvt->queues[i].poll_hist, &poll_hist_fops);
+	}
+}
+static DrvPvt *end_dev_create(Nic *nic, unsigned int index)
+{
+	struct net_device *dev;
+	DrvPvt *pvt;
+	QueuePvt *qp;
+	unsigned int nq;
+	int i, ret;
+
+	nq = nic_hw_num_queues(nic); // One tx/rx queue pair per that of the NIC
+	dev = alloc_etherdev_mqs(struct_size(pvt, queues, nq), nq, nq);
+	if (!dev)
+	{
+		eprintk("device allocation failed\n");
+		return ERR_PTR(-ENOMEM);
+	}
+	pvt = netdev_priv(dev);
+	pvt->ndev = dev;
+	pvt->nic = nic;
+	pvt->desc_mode = nic_hw_desc_mode(nic);
+	pvt->num_queues = nq;
+	for (i = 0; i < nq; i++)
+	{
+		qp = &pvt->queues[i];
+		qp->pvt = pvt;
+		qp->qid = i;
+		netif_napi_add(dev, &qp->napi, end_poll, END_NAPI_WEIGHT);
+		u64_stats_init(&qp->tx_stats.syncp);
+		u64_stats_init(&qp->rx_stats.syncp);
+		u64_stats_init(&qp->xdp_stats.syncp);
+		u64_stats_init(&qp->tx_events.syncp);
+		u64_stats_init(&qp->napi_events.syncp);
+		u64_stats_init(&qp->intr_events.syncp);
+	}
+	// Setting up some MAC Addr - 00:01:02:03:04:05 to be specific, w/ the last byte incremented per NIC
+	for (i = 0; i < dev->addr_len; i++)
+	{
+		dev->dev_addr[i] = i;
+	}
+	dev->dev_addr[dev->addr_len - 1] += index;
+	dev->netdev_ops = &end_netdev_ops;
+	dev->ethtool_ops = &end_ethtool_ops;
+	// Offloads, which can be toggled w/ ethtool -K. Super-pkts need scatter-gather
+	dev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_RXCSUM | NETIF_F_GSO_SOFTWARE;
+	dev->features = dev->hw_features;
+	if ((ret = register_netdev(dev)))
+	{
+		eprintk("%s network interface registration failed w/ error %i\n", dev->name, ret);
+		for (i = 0; i < nq; i++)
+		{
+			netif_napi_del(&pvt->queues[i].napi);
+		}
+		free_netdev(dev);
+		return ERR_PTR(ret);
+	}
+	vnic_set_xps(dev, pvt->num_queues); // Default, once. Thereafter, as set by the admin, if at all
+	// Schedulable & affinable like any task, instead of competing w/ the rest of the softirq work on the core
+	if (threaded)
+	{
+		rtnl_lock(); // As for any change of the napis' state, e.g. through the sysfs
+		ret = dev_set_threaded(dev, true);
+		rtnl_unlock();
+		if (ret)
+		{
+			wprintk("%s threaded napi failed. Continuing w/ the softirq\n", dev->name);
+		}
+	}
+	end_debugfs_init(pvt);
+	return pvt;
+}
+static void end_dev_destroy(DrvPvt *pvt)
+{
+	struct net_device *dev = pvt->ndev;
+	int i;
+
+	unregister_netdev(dev);
+	capture_exit(&pvt->capture);
+	debugfs_remove_recursive(pvt->dbg_dir);
+	for (i = 0; i < pvt->num_queues; i++)
+	{
+		netif_napi_del(&pvt->queues[i].napi);
+	}
+	free_netdev(dev);
+}
+
+static int end_init(void)
+{
+	DrvPvt *pvt;
+	int i;
+
+	iprintk("init\n");
+
+	num_devs = nic_hw_num_nics(); // One interface per NIC, paired w/ it
+	if (!(npvts = kcalloc(num_devs, sizeof(*npvts), GFP_KERNEL)))
+	{
+		return -ENOMEM;
+	}
+	dbg_root = debugfs_create_dir(DRV_PREFIX, NULL);
+	for (i = 0; i < num_devs; i++)
+	{
+		pvt = end_dev_create(nic_hw_get(i), i);
+		if (IS_ERR(pvt))
+		{
+			while (i--)
+			{
+				end_dev_destroy(npvts[i]);
+			}
+			debugfs_remove_recursive(dbg_root);
+			kfree(npvts);
+			return PTR_ERR(pvt);
+		}
+		npvts[i] = pvt; // Hack using global array in absence of a horizontal layer
+	}
+	return 0;
+}
+static void end_exit(void)
+{
+	int i;
+
+	iprintk("exit\n");
+	for (i = 0; i < num_devs; i++)
+	{
+		end_dev_destroy(npvts[i]);
+	}
+	debugfs_remove_recursive(dbg_root);
+	kfree(npvts);
 }
 
 module_init(end_init);
@@ -0,0 +1 @@
+../P04_vnic/pkt_capture.h
\ No newline at end of file
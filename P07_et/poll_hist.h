@@ -0,0 +1 @@
+../P04_vnic/poll_hist.h
\ No newline at end of file
@@ -0,0 +1 @@
+../P04_vnic/vnic_queue.h
\ No newline at end of file
@@ -0,0 +1 @@
+../P04_vnic/vnic_trace.h
\ No newline at end of file